@@ -0,0 +1,473 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use Time::HiRes qw(time);
+use IPC::Open2;
+
+#######################################################################
+# bench.pl - Shell benchmark driver
+#
+# Generates a command script for one of the scenarios below, feeds it
+# to the shell on stdin, and reports the wall time taken.  Run it once
+# against each shell (or each set of shell arguments) to compare them.
+#
+# Scenarios:
+#     true        <n> foreground /bin/true commands; per-command latency
+#     sleep       <n> foreground "/bin/sleep 0.01" commands; wakeup latency
+#     bgjobs      <n> concurrent "/bin/sleep 1 &" jobs; launch throughput
+#                 and time until the job table drains
+#     spawn       <n> /bin/true commands under "-l fork" and "-l spawn"
+#     zygote      <n> /bin/true commands, one at a time, under "-l fork",
+#                 "-l spawn" and "-l zygote", with 200 background jobs,
+#                 a history log and a 1,000,000-word line behind the
+#                 shell; p50 and p99 latency
+#     path        <n> bare "true" commands with a 30-entry PATH: absolute
+#                 path, hashed lookup, and a fresh search every time
+#     pipe        <n> MB (default 1024) from /dev/zero through a 5-stage
+#                 /bin/cat chain; pipeline throughput
+#     zerocopy    <n> MB through cat and tee pipeline stages, run in the
+#                 shell with splice/tee and as external commands (-z)
+#     script      <n> (default 100,000) lines of builtins, read from stdin
+#                 and from a script file named on the command line
+#     parse       <n> (default 100,000) lines under -n (parse only):
+#                 15-token pipelines, one <n>-word line, and random
+#                 fuzz lines; tokens or lines per second
+#     syscalls    <n> foreground and <n> background /bin/true commands
+#                 under "strace -c"; system calls made by the shell
+#                 itself per command
+#     builtins    <n> (default 200,000) lines of builtins through the shell
+#                 and through a copy built with 50 registered builtins;
+#                 builtin lookup must not slow down as the table grows
+#     jobctl      <n> times, stop a background job with SIGSTOP and
+#                 restart it with bg; latency of the stop notification
+#                 and of the bg builtin
+#     here        a <n> MB (default 100) here-document, read from stdin
+#                 and from a script file; then 2,000 cats each of a
+#                 100-byte here-document, here-string and file
+#     subst       <n> (default 10,000) "jobs-max $(...)" lines, with a
+#                 builtin inside, run in the shell, and with /bin/echo
+#     trace       <n> /bin/true commands and 100 * <n> builtin lines,
+#                 without and with -T; the cost of phase tracing
+#     notify      <n> (default 500) background jobs killed all at once;
+#                 every job must get exactly one whole "terminated"
+#                 line, and the script fails if any is lost or garbled
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] -b <bench> -s <shellprog> [-a <args>] [-n <count>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -b <bench>    Scenario to run\n";
+    printf STDERR "  -s <shell>    Shell program to benchmark\n";
+    printf STDERR "  -a <args>     Shell arguments\n";
+    printf STDERR "  -n <count>    Number of iterations\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('hb:s:a:n:');
+if ($opt_h) {
+    usage();
+}
+if (!$opt_b) {
+    usage("Missing required -b argument");
+}
+if (!$opt_s) {
+    usage("Missing required -s argument");
+}
+$bench = $opt_b;
+$shellprog = $opt_s;
+$shellargs = defined($opt_a) ? $opt_a : "-p";
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog is not executable\n";
+
+#
+# runscript - run the shell on a generated script and return the
+#     elapsed wall time in seconds
+#
+sub runscript
+{
+    my ($script) = @_;
+    my $file = "/tmp/bench.$$.txt";
+    my ($start, $elapsed);
+
+    open SCRIPT, ">$file"
+	or die "$0: ERROR: Couldn't create $file: $!\n";
+    print SCRIPT $script;
+    close SCRIPT;
+
+    $start = time;
+    system("$shellprog $shellargs < $file > /dev/null") == 0
+	or die "$0: ERROR: $shellprog exited with status $?\n";
+    $elapsed = time - $start;
+    unlink $file;
+    return $elapsed;
+}
+
+#
+# drive - start the shell with pipes on stdin and stdout
+#
+sub drive
+{
+    my $pid = open2(\*Reader, \*Writer, "$shellprog $shellargs");
+    Writer->autoflush();
+    return $pid;
+}
+
+#
+# readuntil - read shell output until a line equal to $mark, and
+#     return the number of other lines seen
+#
+sub readuntil
+{
+    my ($mark) = @_;
+    my ($line, $count);
+
+    $count = 0;
+    while (defined($line = <Reader>)) {
+	chomp($line);
+	return $count if ($line eq $mark);
+	$count++;
+    }
+    die "$0: ERROR: shell exited before printing $mark\n";
+}
+
+#
+# readmatch - read shell output until a line matching $re, and
+#     return that line
+#
+sub readmatch
+{
+    my ($re) = @_;
+    my $line;
+
+    while (defined($line = <Reader>)) {
+	return $line if ($line =~ $re);
+    }
+    die "$0: ERROR: shell exited before printing $re\n";
+}
+
+#
+# report - print one result line
+#
+sub report
+{
+    my ($what, $n, $elapsed) = @_;
+    printf("%-10s %8d ops %9.3f s %10.1f us/op %10.0f ops/s\n",
+	   $what, $n, $elapsed, 1e6 * $elapsed / $n, $n / $elapsed);
+}
+
+if ($bench eq "true") {
+    $n = $opt_n || 1000;
+    report("true", $n, runscript("/bin/true\n" x $n));
+}
+elsif ($bench eq "sleep") {
+    $n = $opt_n || 100;
+    $elapsed = runscript("/bin/sleep 0.01\n" x $n);
+    report("sleep", $n, $elapsed);
+    printf("%-10s %29.1f us/op over the 10 ms child\n", "overhead",
+	   1e6 * ($elapsed - 0.01 * $n) / $n);
+}
+elsif ($bench eq "bgjobs") {
+    $n = $opt_n || 1000;
+    $pid = drive();
+    $start = time;
+    for ($i = 0; $i < $n; $i++) {
+	print Writer "/bin/sleep 1 &\n";
+	if ($i % 100 == 99) {	# keep the shell's output pipe drained
+	    print Writer "/bin/echo mark\n";
+	    readuntil("mark");
+	}
+    }
+    print Writer "/bin/echo launched\n";
+    readuntil("launched");
+    $launched = time;
+    do {
+	print Writer "jobs\n/bin/echo listed\n";
+    } while (readuntil("listed") > 0);
+    $reaped = time;
+    close Writer;
+    waitpid($pid, 0);
+    report("launch", $n, $launched - $start);
+    report("drain", $n, $reaped - $launched);
+}
+elsif ($bench eq "spawn") {
+    $n = $opt_n || 2000;
+    $args = $shellargs;
+    foreach $l ("fork", "spawn") {
+	$shellargs = "$args -l $l";
+	report($l, $n, runscript("/bin/true\n" x $n));
+    }
+}
+elsif ($bench eq "zygote") {
+    $n = $opt_n || 2000;
+    $args = $shellargs;
+    $hist = "/tmp/bench.$$.hist";
+    foreach $l ("fork", "spawn", "zygote") {
+	$shellargs = "$args -l $l -H $hist";
+	$pid = drive();
+
+	# A big shell: a full job table, and a parse arena grown to fit
+	# a long line
+	%pgid = ();
+	for ($i = 0; $i < 200; $i++) {
+	    print Writer "/bin/sleep 1000 &\n";
+	    readmatch(qr/^\[\d+\] \(\d+\)/) =~ /\((\d+)\)/;
+	    $pgid{$1} = 1;
+	}
+	print Writer "jobs-max" . " x" x 1000000 . "\njobs-max\n";
+	readuntil("0");
+
+	# jobs-max prints 0 once the command before it is done
+	@lat = ();
+	for ($i = 0; $i < $n; $i++) {
+	    $start = time;
+	    print Writer "/bin/true\njobs-max\n";
+	    readuntil("0");
+	    push(@lat, time - $start);
+	}
+	kill('KILL', -$_) foreach (keys %pgid);
+	close Writer;
+	waitpid($pid, 0);
+	unlink $hist;
+	@lat = sort { $a <=> $b } @lat;
+	printf("%-10s %8d ops %10.1f us p50 %10.1f us p99\n", $l, $n,
+	       1e6 * $lat[int($n / 2)], 1e6 * $lat[int($n * 0.99)]);
+    }
+}
+elsif ($bench eq "path") {
+    $n = $opt_n || 2000;
+    for ($i = 0; $i < 29; $i++) {
+	mkdir("/tmp/bench.$$.$i");
+	push(@dirs, "/tmp/bench.$$.$i");
+    }
+    $path = $ENV{PATH};
+    $ENV{PATH} = join(":", @dirs, "/bin");
+    report("absolute", $n, runscript("/bin/true\n" x $n));
+    report("hashed", $n, runscript("true\n" x $n));
+    report("search", $n, runscript("hash -r\ntrue\n" x $n));
+    $ENV{PATH} = $path;
+    rmdir($_) foreach (@dirs);
+}
+elsif ($bench eq "pipe") {
+    $n = $opt_n || 1024;
+    $elapsed = runscript("/usr/bin/head -c ${n}M /dev/zero" .
+			 " | /bin/cat" x 5 . " > /dev/null\n");
+    printf("%-10s %8d MB %10.3f s %10.1f MB/s\n", "pipe", $n, $elapsed,
+	   $n / $elapsed);
+}
+elsif ($bench eq "zerocopy") {
+    $n = $opt_n || 1024;
+    $args = $shellargs;
+    %pipelines = ("cat" => " | /bin/cat" x 5 . " > /dev/null\n",
+		  "tee" => " | /usr/bin/tee /dev/null | /bin/cat > /dev/null\n");
+    foreach $p ("cat", "tee") {
+	foreach $z ("", " -z") {
+	    $shellargs = "$args$z";
+	    $elapsed = runscript("/usr/bin/head -c ${n}M /dev/zero" .
+				 $pipelines{$p});
+	    printf("%-10s %8d MB %10.3f s %10.2f GB/s\n",
+		   $z ? "$p -z" : $p, $n, $elapsed, $n / 1024 / $elapsed);
+	}
+    }
+}
+elsif ($bench eq "script") {
+    $n = $opt_n || 100000;
+    $script = "jobs\nhash\n" x ($n / 2);
+    $args = $shellargs;
+    foreach $mode ("stdin", "script") {
+	$shellargs = ($mode eq "script") ? "$args /tmp/bench.$$.txt" : $args;
+	$elapsed = runscript($script);
+	printf("%-10s %8d lines %9.3f s %10.0f lines/s\n", $mode, $n,
+	       $elapsed, $n / $elapsed);
+    }
+}
+elsif ($bench eq "parse") {
+    $n = $opt_n || 100000;
+    $shellargs = "$shellargs -n";
+    $line = "/bin/cat<in.txt|/usr/bin/tr a-z A-Z 2>err.txt | " .
+	"\"/bin/wc\" -l >>'out file' &\n";
+    $elapsed = runscript($line x $n);
+    printf("%-10s %8d tokens %9.3f s %10.0f tokens/s\n", "pipeline",
+	   15 * $n, $elapsed, 15 * $n / $elapsed);
+    $elapsed = runscript("/bin/true" . " word" x $n . "\n");
+    printf("%-10s %8d tokens %9.3f s %10.0f tokens/s\n", "wide",
+	   $n + 1, $elapsed, ($n + 1) / $elapsed);
+    @chars = split(//, " \t|&<>2'\"\\abc-");
+    $script = "";
+    for ($i = 0; $i < $n; $i++) {
+	$script .= $chars[rand @chars] for (1 .. rand 60);
+	$script .= "\n";
+    }
+    $script =~ s/<</< </g;	# a here-doc would swallow the lines after it
+    $elapsed = runscript($script);
+    printf("%-10s %8d lines %9.3f s %10.0f lines/s\n", "fuzz",
+	   $n, $elapsed, $n / $elapsed);
+}
+elsif ($bench eq "syscalls") {
+    $n = $opt_n || 1000;
+    $prog = $shellprog;
+    $trace = "/tmp/bench.$$.strace";
+    system("strace -V > /dev/null 2>&1") == 0
+	or die "$0: ERROR: syscalls needs strace on the PATH\n";
+    foreach $cmd ("/bin/true", "/bin/true &") {
+	$shellprog = "strace -c -o $trace $prog";
+	$elapsed = runscript("$cmd\n" x $n);
+	open TRACE, $trace
+	    or die "$0: ERROR: Couldn't open $trace: $!\n";
+	$calls = 0;
+	while (<TRACE>) {
+	    $calls = $1 if (/^\s*[\d.]+\s+[\d.]+\s+\d+\s+(\d+)\s.*total$/);
+	}
+	close TRACE;
+	unlink $trace;
+	printf("%-10s %8d ops %9d calls %10.1f calls/op\n",
+	       $cmd =~ /&/ ? "bg" : "fg", $n, $calls, $calls / $n);
+    }
+}
+elsif ($bench eq "builtins") {
+    $n = $opt_n || 200000;
+    $dir = "/tmp/bench.$$.d";
+    mkdir($dir)
+	or die "$0: ERROR: Couldn't create $dir: $!\n";
+    open DEFS, "builtins.def"
+	or die "$0: ERROR: Couldn't open builtins.def: $!\n";
+    open MORE, ">$dir/builtins.def"
+	or die "$0: ERROR: Couldn't create $dir/builtins.def: $!\n";
+    $count = 0;
+    while (<DEFS>) {
+	print MORE $_;
+	$count++ if (!/^\s*(#|$)/);
+    }
+    close DEFS;
+    print MORE "nop$_ do_jobs\n" foreach ($count + 1 .. 50);
+    close MORE;
+    system("./mkbuiltins.pl $dir/builtins.def > $dir/builtins.h && " .
+	   "cp tsh.c $dir && gcc -Wall -O2 -o $dir/tsh $dir/tsh.c") == 0
+	or die "$0: ERROR: Couldn't build a shell with 50 builtins\n";
+    $script = "jobs\nhash\nfg\nbg\n" x ($n / 4);
+    $prog = $shellprog;
+    foreach $shell ($prog, "$dir/tsh") {
+	$shellprog = $shell;
+	$elapsed = runscript($script);
+	printf("%-12s %8d lines %9.3f s %10.3f us/line\n",
+	       ($shell eq $prog ? $count : 50) . " builtins", $n, $elapsed,
+	       1e6 * $elapsed / $n);
+    }
+    unlink("$dir/builtins.def", "$dir/builtins.h", "$dir/tsh.c", "$dir/tsh");
+    rmdir($dir);
+}
+elsif ($bench eq "jobctl") {
+    $n = $opt_n || 1000;
+    $pid = drive();
+    print Writer "/bin/sleep 1000 &\n";
+    readmatch(qr/^\[1\] \((\d+)\)/) =~ /\((\d+)\)/;
+    $pgid = $1;
+    $stop = $cont = 0;
+    for ($i = 0; $i < $n; $i++) {
+	$start = time;
+	kill('STOP', -$pgid);
+	readmatch(qr/stopped by signal/);
+	$stopped = time;
+	print Writer "bg %1\n";
+	readmatch(qr/^\[1\] /);
+	$stop += $stopped - $start;
+	$cont += time - $stopped;
+    }
+    kill('KILL', -$pgid);
+    close Writer;
+    waitpid($pid, 0);
+    report("stop", $n, $stop);
+    report("bg", $n, $cont);
+}
+elsif ($bench eq "here") {
+    $n = $opt_n || 100;
+    $line = "x" x 99 . "\n";
+    $script = "/bin/cat <<EOF > /dev/null\n" . $line x (10486 * $n) .
+	"EOF\n";
+    $args = $shellargs;
+    foreach $mode ("stdin", "script") {
+	$shellargs = ($mode eq "script") ? "$args /tmp/bench.$$.txt" : $args;
+	$elapsed = runscript($script);
+	printf("%-10s %8d MB %10.3f s %10.1f MB/s\n", "doc $mode", $n,
+	       $elapsed, $n / $elapsed);
+    }
+    $shellargs = $args;
+    $m = 2000;
+    $file = "/tmp/bench.$$.in";
+    open IN, ">$file"
+	or die "$0: ERROR: Couldn't create $file: $!\n";
+    print IN $line;
+    close IN;
+    chop($word = $line);
+    report("doc", $m, runscript("/bin/cat <<EOF > /dev/null\n${line}EOF\n" x $m));
+    report("string", $m, runscript("/bin/cat <<< $word > /dev/null\n" x $m));
+    report("file", $m, runscript("/bin/cat < $file > /dev/null\n" x $m));
+    unlink $file;
+}
+elsif ($bench eq "subst") {
+    $n = $opt_n || 10000;
+    report("none", $n, runscript("jobs-max 0\n" x $n));
+    report("builtin", $n, runscript("jobs-max \$(jobs-max)\n" x $n));
+    report("external", $n, runscript("jobs-max \$(/bin/echo 0)\n" x $n));
+}
+elsif ($bench eq "trace") {
+    $n = $opt_n || 2000;
+    $args = $shellargs;
+    $file = "/tmp/bench.$$.trace";
+    foreach $t ("", " -T $file") {
+	$shellargs = "$args$t";
+	report("true" . ($t ? " -T" : ""), $n, runscript("/bin/true\n" x $n));
+	report("builtin" . ($t ? " -T" : ""), 100 * $n,
+	       runscript("jobs-max 0\n" x (100 * $n)));
+    }
+    $shellargs = $args;
+    unlink $file;
+}
+elsif ($bench eq "notify") {
+    $n = $opt_n || 500;
+    $pid = drive();
+    for ($i = 0; $i < $n; $i++) {
+	print Writer "./myspin 1000 &\n";
+    }
+    print Writer "/bin/echo launched\n";
+    while (($line = readmatch(qr/^(\[\d+\] \(\d+\)|launched$)/)) =~ /^\[(\d+)\] \((\d+)\)/) {
+	$pgid{$1} = $2;
+    }
+    keys(%pgid) == $n
+	or die "$0: ERROR: started " . keys(%pgid) . " of $n jobs\n";
+
+    $start = time;
+    kill('TERM', -$_) foreach (values %pgid);
+    $SIG{ALRM} = sub { die "$0: ERROR: " . ($n - $seen) . " notifications lost\n"; };
+    alarm(30);
+    $seen = $garbled = 0;
+    while ($seen < $n && defined($line = <Reader>)) {
+	if ($line =~ /^Job \[(\d+)\] \((\d+)\) terminated by signal 15\n$/ &&
+	    $pgid{$1} == $2) {
+	    delete $pgid{$1};
+	    $seen++;
+	} else {
+	    print "garbled: $line";
+	    $garbled++;
+	}
+    }
+    alarm(0);
+    $elapsed = time - $start;
+    close Writer;
+    waitpid($pid, 0);
+    report("notify", $n, $elapsed);
+    printf("%d lost, %d garbled\n", $n - $seen, $garbled);
+    exit(($seen == $n && $garbled == 0) ? 0 : 1);
+}
+else {
+    usage("Unknown benchmark $bench");
+}
+
+exit;
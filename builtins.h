@@ -0,0 +1,18 @@
+/* 
+ * builtins.h - The builtin command table, generated from builtins.def
+ *    by mkbuiltins.pl. Edit builtins.def instead.
+ */
+#define BUILTIN_SEED  0u
+#define BUILTIN_SLOTS 32
+
+struct builtin_t builtins[BUILTIN_SLOTS] = {
+    [6] = {"bg", do_bgfg},
+    [7] = {"coproc", do_coproc},
+    [17] = {"hash", do_hash},
+    [20] = {"limit", do_limit},
+    [22] = {"quit", do_quit},
+    [26] = {"fg", do_bgfg},
+    [29] = {"jobs", do_jobs},
+    [30] = {"jobs-max", do_jobsmax},
+    [31] = {"history", do_history},
+};
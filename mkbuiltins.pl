@@ -0,0 +1,107 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#######################################################################
+# mkbuiltins.pl - Builtin table generator
+#
+# Reads a builtin definition file (builtins.def), which names each
+# builtin command and the function that runs it, and writes a C header
+# with the table tsh dispatches builtins through. The table is a
+# perfect hash: the generator searches for a seed under which every
+# name gets a slot of its own, so findbuiltin() in tsh.c needs one
+# hash and one strcmp to look up any name, however many builtins
+# there are.
+#
+# Definition file format:
+#
+# Blank lines and lines starting with "#" are ignored. Every other
+# line is "<name> <handler>", where <handler> is a function in tsh.c
+# taking the command's argv. Several names may share a handler.
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] <deffile>\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('h');
+if ($opt_h) {
+    usage();
+}
+if (@ARGV != 1) {
+    usage("Missing builtin definition file");
+}
+$deffile = $ARGV[0];
+
+#
+# hash - FNV-1a of a name, started from the seed; this must compute
+#     the same function as findbuiltin() in tsh.c
+#
+sub hash
+{
+    my ($name, $seed) = @_;
+    my $h = (2166136261 ^ $seed) & 0xffffffff;
+
+    foreach (unpack("C*", $name)) {
+	$h ^= $_;
+	$h = ($h * 16777619) & 0xffffffff;
+    }
+    return $h;
+}
+
+# Read the definitions
+open DEFS, $deffile
+    or die "$0: ERROR: Couldn't open $deffile: $!\n";
+while (<DEFS>) {
+    next if (/^\s*(#|$)/);
+    /^\s*([^\s"\\]+)\s+([A-Za-z_]\w*)\s*$/
+	or die "$0: ERROR: $deffile:$.: expected \"<name> <handler>\"\n";
+    !defined($handler{$1})
+	or die "$0: ERROR: $deffile:$.: $1 is defined twice\n";
+    $handler{$1} = $2;
+    push(@names, $1);
+}
+close DEFS;
+@names
+    or die "$0: ERROR: $deffile defines no builtins\n";
+
+# Find a seed that gives every name its own slot, in a table at least
+# twice the number of names, doubling the table if none turns up
+$slots = 2;
+$slots *= 2 while ($slots < 2 * @names);
+SEARCH: while (1) {
+  SEED: for ($seed = 0; $seed < 10000; $seed++) {
+	%slot = ();
+	foreach $name (@names) {
+	    $i = hash($name, $seed) & ($slots - 1);
+	    next SEED if (defined($slot{$i}));
+	    $slot{$i} = $name;
+	}
+	last SEARCH;
+    }
+    $slots *= 2;
+}
+
+print "/* \n";
+print " * builtins.h - The builtin command table, generated from $deffile\n";
+print " *    by mkbuiltins.pl. Edit $deffile instead.\n";
+print " */\n";
+printf("#define BUILTIN_SEED  %du\n", $seed);
+printf("#define BUILTIN_SLOTS %d\n", $slots);
+print "\n";
+print "struct builtin_t builtins[BUILTIN_SLOTS] = {\n";
+foreach $i (sort { $a <=> $b } keys %slot) {
+    printf("    [%d] = {\"%s\", %s},\n", $i, $slot{$i}, $handler{$slot{$i}});
+}
+print "};\n";
+
+exit;
@@ -0,0 +1,314 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use POSIX qw(:sys_wait_h);
+use Time::HiRes qw(time sleep);
+use File::Temp qw(tempdir);
+use File::Spec;
+
+#######################################################################
+# runtraces.pl - Parallel trace runner
+#
+# Runs every trace through sdriver.pl at the same time, each driver
+# in a process group of its own, once with the shell under test and
+# once with the reference shell. The two outputs are compared after
+# normalizing them the way tshref.out has to be read: PIDs in
+# parentheses become "(PID)", and the process table printed by ps and
+# any messages from make are dropped. If the reference shell can't be
+# run on this machine, the expected output for a trace is taken from
+# its section of tshref.out instead. Traces that tshref.out doesn't
+# cover are newer than the reference shell, and are checked against
+# their section of tshnew.out. Prints one line per trace with its
+# result and wall time.
+#
+# Each driver runs in a directory of its own, holding links to the
+# trace and to the programs in the current directory, so that traces
+# which create files can't see each other's.
+#
+# The shell arguments for each trace are those of its testNN target
+# in the Makefile, so the two never disagree.
+#
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hv] -s <shellprog> [-r <refshell>] [-o <refout>] [-e <newout>] [-j <jobs>] [-T <secs>] [trace...]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -v            Print a diff for every failed trace\n";
+    printf STDERR "  -s <shell>    Shell program to test\n";
+    printf STDERR "  -r <shell>    Reference shell (default ./tshref)\n";
+    printf STDERR "  -o <file>     Reference output (default tshref.out)\n";
+    printf STDERR "  -e <file>     Output of traces newer than tshref (default tshnew.out)\n";
+    printf STDERR "  -j <jobs>     Most drivers to run at once (default: all)\n";
+    printf STDERR "  -T <secs>     Kill a driver after <secs> seconds (default 60)\n";
+    die "\n" ;
+}
+
+# Parse the command line arguments
+getopts('hvs:r:o:e:j:T:');
+if ($opt_h) {
+    usage();
+}
+if (!$opt_s) {
+    usage("Missing required -s argument");
+}
+$verbose = $opt_v;
+$shellprog = $opt_s;
+$refprog = $opt_r || "./tshref";
+$refout = $opt_o || "tshref.out";
+$newout = $opt_e || "tshnew.out";
+$timeout = $opt_T || 60;
+$driver = File::Spec->rel2abs("./sdriver.pl");
+@traces = @ARGV ? @ARGV : sort glob("trace*.txt");
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog is not executable\n";
+$maxjobs = $opt_j || 2 * @traces;
+
+#
+# traceargs - read the shell arguments of each testNN target from
+#     the Makefile
+#
+sub traceargs
+{
+    my (%args, %vars, $line);
+
+    open MAKEFILE, "Makefile"
+	or return %args;
+    while ($line = <MAKEFILE>) {
+	if ($line =~ /^(\w+)\s*=\s*(.*?)\s*$/) {
+	    $vars{$1} = $2;
+	}
+	elsif ($line =~ /^\t\$\(DRIVER\) -t (\S+) -s \$\(TSH\) -a (.*?)\s*$/) {
+	    $args{$1} = $2;
+	}
+    }
+    close MAKEFILE;
+    foreach (values %args) {
+	s/\$\((\w+)\)/$vars{$1}/g;
+	s/^"(.*)"$/$1/;
+    }
+    return %args;
+}
+
+#
+# refsections - split an output file in the form of tshref.out into
+#     the output of each trace
+#
+sub refsections
+{
+    my ($file) = @_;
+    my (%out, $trace, $line);
+
+    open REFOUT, $file
+	or return %out;
+    while ($line = <REFOUT>) {
+	if ($line =~ /^\S*sdriver\.pl -t (\S+)/) {
+	    $trace = $1;
+	    $out{$trace} = "";
+	}
+	elsif (defined($trace)) {
+	    $out{$trace} .= $line;
+	}
+    }
+    close REFOUT;
+    return %out;
+}
+
+#
+# normalize - make two runs of a trace comparable
+#
+sub normalize
+{
+    my ($text) = @_;
+    my ($line, $out);
+
+    $out = "";
+    foreach $line (split(/^/m, $text)) {
+	next if ($line =~ /^\s*PID\s+TTY\b/);
+	next if ($line =~ /^\s*\d+\s+(\?|pts\/\d+|tty\w*)\s/);
+	next if ($line =~ /^make(\[\d+\])?: /);
+	$line =~ s/\(\d+\)/(PID)/g;
+	$out .= $line;
+    }
+    return $out;
+}
+
+#
+# slurp - return the contents of a file
+#
+sub slurp
+{
+    my ($file) = @_;
+    local $/;
+
+    open SLURP, $file
+	or return "";
+    my $text = <SLURP>;
+    close SLURP;
+    return $text;
+}
+
+#
+# rundir - make a directory for one run, with links to its trace and
+#     to every program in the current directory
+#
+sub rundir
+{
+    my ($run) = @_;
+    my $rdir = "$run->{out}.d";
+    my $file;
+
+    mkdir($rdir)
+	or die "$0: ERROR: Couldn't create $rdir: $!\n";
+    foreach $file ($run->{trace}, grep { -f $_ && -x $_ } glob("*")) {
+	symlink(File::Spec->rel2abs($file), "$rdir/$file")
+	    or die "$0: ERROR: Couldn't link $file: $!\n";
+    }
+    return $rdir;
+}
+
+#
+# start - fork a driver for one trace in a new process group and a
+#     directory of its own, with its output going to a file
+#
+sub start
+{
+    my ($run) = @_;
+    my $rdir = rundir($run);
+    my $shell = File::Spec->rel2abs($run->{shell});
+    my $pid = fork();
+
+    defined($pid)
+	or die "$0: ERROR: fork failed: $!\n";
+    if ($pid == 0) {
+	setpgrp(0, 0);
+	open STDOUT, ">", $run->{out}
+	    or die "$0: ERROR: Couldn't create $run->{out}: $!\n";
+	open STDERR, ">&STDOUT";
+	chdir($rdir)
+	    or die "$0: ERROR: Couldn't enter $rdir: $!\n";
+	# run through perl, since sdriver.pl isn't executable as checked out
+	exec($^X, $driver, "-t", $run->{trace}, "-s", $shell,
+	     "-a", $run->{args});
+	die "$0: ERROR: Couldn't run $driver: $!\n";
+    }
+    $run->{pid} = $pid;
+    $run->{start} = time;
+}
+
+#
+# runnable - check that a program can be exec'd on this machine
+#
+sub runnable
+{
+    my ($prog) = @_;
+    my $pid;
+
+    -x $prog
+	or return 0;
+    defined($pid = fork())
+	or die "$0: ERROR: fork failed: $!\n";
+    if ($pid == 0) {
+	open STDOUT, ">/dev/null";
+	open STDERR, ">&STDOUT";
+	exec($prog, "-h");
+	POSIX::_exit(127);
+    }
+    waitpid($pid, 0);
+    return ($? >> 8) != 127;
+}
+
+# A reference shell built for another machine can't be run here, in
+# which case tshref.out is the reference. Traces newer than tshref
+# are always checked against tshnew.out.
+%args = traceargs();
+%expected = refsections($refout);
+%newer = refsections($newout);
+$useref = runnable($refprog);
+
+# One run per trace and shell, started as slots free up
+$dir = tempdir("runtraces.XXXXXX", TMPDIR => 1, CLEANUP => 1);
+foreach $trace (@traces) {
+    -r $trace
+	or die "$0: ERROR: $trace is not readable\n";
+    $hasref = $useref && defined($expected{$trace});
+    foreach $shell ($hasref ? ($shellprog, $refprog) : ($shellprog)) {
+	push(@queue, { trace => $trace, shell => $shell,
+		       args => defined($args{$trace}) ? $args{$trace} : "-p",
+		       out => "$dir/$trace." . ($shell eq $refprog ? "ref" : "out") });
+    }
+}
+@runs = @queue;
+
+$start = time;
+%running = ();
+while (@queue || %running) {
+    while (@queue && keys(%running) < $maxjobs) {
+	$run = shift(@queue);
+	start($run);
+	$running{$run->{pid}} = $run;
+    }
+    while (($pid = waitpid(-1, WNOHANG)) > 0) {
+	if ($run = delete($running{$pid})) {
+	    $run->{elapsed} = time - $run->{start};
+	    $run->{status} = $?;
+	}
+    }
+    foreach $run (values %running) {
+	if (time - $run->{start} > $timeout) {
+	    kill('KILL', -$run->{pid});
+	    $run->{timedout} = 1;
+	}
+    }
+    sleep(0.01);
+}
+$wall = time - $start;
+
+# Compare and report
+$failed = $passed = $unchecked = 0;
+$serial = 0;
+foreach $run (@runs) {
+    $serial += $run->{elapsed};
+    next if ($run->{shell} eq $refprog);
+    $trace = $run->{trace};
+    $got = normalize(slurp($run->{out}));
+    if (!defined($expected{$trace})) {
+	$want = defined($newer{$trace}) ? normalize($newer{$trace}) : undef;
+    } elsif ($useref) {
+	$want = normalize(slurp("$dir/$trace.ref"));
+    } else {
+	$want = normalize($expected{$trace});
+    }
+
+    if ($run->{timedout}) {
+	$result = "TIMEOUT";
+	$failed++;
+    } elsif (!defined($want)) {
+	$result = "no ref";
+	$unchecked++;
+    } elsif ($got eq $want) {
+	$result = "ok";
+	$passed++;
+    } else {
+	$result = "FAIL";
+	$failed++;
+    }
+    printf("%-12s %-8s %7.2f s\n", $trace, $result, $run->{elapsed});
+
+    if ($verbose && $result ne "ok" && defined($want)) {
+	open WANT, ">$dir/want" and print WANT $want;
+	close WANT;
+	open GOT, ">$dir/got" and print GOT $got;
+	close GOT;
+	system("diff $dir/want $dir/got");
+    }
+}
+printf("%d ok, %d failed, %d without a reference; %.2f s wall, %.2f s serial\n",
+       $passed, $failed, $unchecked, $wall, $serial);
+
+exit($failed ? 1 : 0);
@@ -3,6 +3,8 @@
 use Getopt::Std;
 use FileHandle;
 use IPC::Open2;
+use IO::Select;
+use Time::HiRes qw(time);
 
 #######################################################################
 # sdriver.pl - Shell driver
@@ -33,6 +35,21 @@ use IPC::Open2;
 #     CLOSE       Close Writer (sends EOF signal to child)
 #     WAIT        Wait() for child to terminate
 #     SLEEP <n>   Sleep for <n> seconds
+#     WAITFOR <regex>
+#                 Wait until the child's output since the last WAITFOR
+#                 matches the Perl regex <regex>
+#     WAITSTATE <jid> <state> [<live>]
+#                 Wait until job <jid> is in <state> (FG, BG, ST or QU), or
+#                 is gone if <state> is NONE, and if <live> is given, has
+#                 that many of its processes left to reap. The child's
+#                 job table is polled with SIGUSR1, which makes the
+#                 shell print it between "%jobs <n>" and %end lines,
+#                 where <n> is how many input lines it has run; those
+#                 are not echoed.
+#                 Only a table covering every line sent so far counts.
+#
+# The WAIT* commands give up with an error after 10 seconds. Driver
+# commands must be the only thing on their line.
 # 
 ######################################################################
 
@@ -83,6 +100,75 @@ $grade = $opt_g;
     or die "$0: ERROR: $shellprog is not executable\n";
 
 
+#
+# readoutput - append whatever the child writes within $timeout
+#     seconds (for ever if undef) to $output, taking out any job
+#     tables. Returns false at end of file.
+#
+sub readoutput
+{
+    my ($timeout) = @_;
+    my ($chunk, $n);
+
+    return 1 if (!$select->can_read($timeout));
+    $n = sysread(Reader, $chunk, 65536);
+    return 0 if (!$n);
+    $output .= $chunk;
+    while ($output =~ s/^%jobs (\d+)\n(.*?)^%end\n//ms) {
+	$jobtable = $2 if ($1 >= $sent);
+    }
+    return 1;
+}
+
+#
+# waitfor - wait until the output since the last match matches $re
+#
+sub waitfor
+{
+    my ($re) = @_;
+    my $deadline = time + $waitlimit;
+
+    while (time < $deadline) {
+	pos($output) = $matched;
+	if ($output =~ /$re/gm) {
+	    $matched = pos($output);
+	    return;
+	}
+	readoutput($deadline - time)
+	    or last;
+    }
+    print "$0: ERROR: timed out waiting for output /$re/\n";
+}
+
+#
+# waitstate - poll the job table until job $jid is in $state
+#
+sub waitstate
+{
+    my ($jid, $state, $live) = @_;
+    my ($deadline, $asked, $now, $nlive);
+
+    $deadline = time + $waitlimit;
+    $asked = 0;
+    undef $jobtable;
+    while (time < $deadline) {
+	if (defined($jobtable)) {
+	    ($now, $nlive) = ($jobtable =~ /^$jid \d+ (\w+) (\d+)$/m);
+	    $now = "NONE" if (!defined($now));
+	    return if ($now eq $state && (!defined($live) || $nlive == $live));
+	    undef $jobtable;
+	    $asked = 0;
+	}
+	if (time - $asked > 0.1) {
+	    kill 'USR1', $pid;
+	    $asked = time;
+	}
+	readoutput(0.005)
+	    or last;
+    }
+    print "$0: ERROR: timed out waiting for job $jid to be $state\n";
+}
+
 # Open the input script
 open INFILE, $infile
     or die "$0: ERROR: Couldn't open input file $infile: $!\n";
@@ -93,8 +179,17 @@ open INFILE, $infile
 #     parent:Writer -> child:stdin
 #     child:stdout  -> parent:Reader
 #
-$pid = open2(\*Reader, \*Writer, "$shellprog $shellargs");
+# A SIGUSR1 that arrives before the shell is ready for it is dropped
+{
+    local $SIG{USR1} = 'IGNORE';
+    $pid = open2(\*Reader, \*Writer, "$shellprog $shellargs");
+}
 Writer->autoflush();
+$select = IO::Select->new(\*Reader);
+$output = "";   # child output read so far
+$matched = 0;   # where the next WAITFOR starts looking in $output
+$sent = 0;      # lines sent to the child
+$waitlimit = 10;
 
 # The autograder will want to know the child shell's pid
 if ($grade) {
@@ -120,6 +215,22 @@ while (<INFILE>) {
 	}
     }
 
+    # Wait for the child to print something
+    elsif ($line =~ /^WAITFOR (.*)$/) {
+	if ($verbose) {
+	    print "$0: Waiting for output /$1/\n";
+	}
+	waitfor($1);
+    }
+
+    # Wait for a job to reach a state
+    elsif ($line =~ /^WAITSTATE (\d+) (FG|BG|ST|QU|NONE)(?: (\d+))?$/) {
+	if ($verbose) {
+	    print "$0: Waiting for job $1 to be $2\n";
+	}
+	waitstate($1, $2, $3);
+    }
+
     # Send SIGTSTP (ctrl-z)
     elsif ($line =~ /TSTP/) {
 	if ($verbose) {
@@ -185,6 +296,7 @@ while (<INFILE>) {
 	    print "$0: Sending :$line: to child $pid\n";
 	}
 	print Writer "$line\n";
+	$sent++;
     }
 }
 
@@ -195,9 +307,9 @@ close Writer;
 if ($verbose) {
     print "$0: Reading data from child $pid\n";
 }
-while ($line = <Reader>) {
-    print $line;
+while (readoutput(undef)) {
 }
+print $output;
 close Reader;
 
 # Finally, parent reaps child
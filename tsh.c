@@ -4,6 +4,7 @@
  * Weishan Li, 30755725
  * Jack DeGuglielmo, 30900481
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,20 +13,79 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/prctl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sched.h>
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
+#define MAXLINE    1024   /* max size of a composed message or path */
+#define MINJOBS      16   /* initial size of the job table */
 #define MAXJID    1<<16   /* max job ID */
+#define HASHSIZE     64   /* buckets in the command hash */
+#define INBUFSIZE 65536   /* bytes of stdin read at a time */
+#define OUTBUFSIZE 65536  /* stdout buffer when it isn't a terminal */
+#define ARENACHUNK 16384  /* bytes in a parse arena block */
+#define HISTGROW   4096   /* records the history log grows by */
+#define HISTSHOW     20   /* history records shown by default */
+#define NOTESIZE  65536   /* bytes of job notifications held for output */
+#define TRACERING 65536   /* events the -T trace ring holds */
+
+/* Launchers for external commands */
+#define LAUNCH_FORK  0  /* fork, then execve in the child */
+#define LAUNCH_SPAWN 1  /* posix_spawn */
+#define LAUNCH_ZYGOTE 2 /* a helper forked at startup, over a socket */
+#define ZYGMSG   65536  /* largest launch request sent to the zygote */
+#define ZYGFDS      16  /* most fds sent with one launch request */
+#define ZYGSTACK 65536  /* stack the zygote's children run on until exec */
+
+/* Pass-through pipeline stages the shell runs itself */
+#define PASS_NONE 0     /* an ordinary command */
+#define PASS_CAT  1     /* bare cat: the stage is dropped */
+#define PASS_TEE  2     /* tee file...: spliced by a forked helper */
+#define PASS_PAR  3     /* par ...: fanned out by a forked helper */
+#define PUMPCHUNK 65536 /* most bytes moved per splice */
+
+/* Command line tokens */
+#define TOK_END   0     /* end of the line */
+#define TOK_WORD  1     /* a word, with its quotes removed */
+#define TOK_PIPE  2     /* | */
+#define TOK_REDIR 3     /* <, >, >>, 2>, << or <<< */
+#define TOK_BG    4     /* & */
+
+/* What a redirection reads from or writes to */
+#define REDIR_FILE 0    /* a named file */
+#define REDIR_DOC  1    /* the lines up to a delimiter: <<word */
+#define REDIR_STR  2    /* a word and a newline: <<< word */
+
+/* Mode of files created by output redirection */
+#define REDIR_MODE (S_IRWXU|S_IRWXG|S_IRWXO)
 
 /* Job states */
 #define UNDEF 0 /* undefined */
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define QU 4    /* queued until a background slot is free */
+
+/* States of the processes in a job */
+#define M_RUN  0 /* running */
+#define M_STOP 1 /* stopped */
+#define M_DONE 2 /* reaped */
 
 /* 
  * Jobs states: FG (foreground), BG (background), ST (stopped)
@@ -34,23 +94,262 @@
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
- * At most 1 job can be in the FG state.
+ *     QU -> BG  : a background job finishes or stops, or bg command
+ *     QU -> FG  : fg command
+ * At most 1 job can be in the FG state. With -j n, a job started with
+ * & once n jobs are in the BG state is queued (QU) instead, and the
+ * queued jobs start in the order they were queued.
  */
 
 /* Global variables */
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
-int nextjid = 1;            /* next job ID to allocate */
+int launcher = LAUNCH_FORK; /* how external commands are started */
+int fastpipes = 1;          /* if true, run cat/tee stages in the shell */
+int noexec = 0;             /* if true, parse commands but don't run them */
+int maxbg = 0;              /* most jobs in the BG state at once, 0 for any */
+int queuemoved = 0;         /* if true, maxbg changed and the queue may move */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
+int sigfd;                  /* signalfd for SIGCHLD, SIGINT and SIGTSTP */
+int epfd;                   /* epoll set watching stdin and sigfd */
+int stdinpoll = 1;          /* if false, stdin is a file epoll can't watch */
+sigset_t origmask;          /* signal mask the shell was started with */
+int zygfd = -1;             /* socket to the zygote launcher, or -1 */
+int stalepipe[2] = {-1, -1}; /* forked stages name stale hashed commands on it */
+
+struct inbuf_t {            /* The shell's input, read ahead */
+    char *buf;              /* stdin block, mapped script, or -c string */
+    size_t start;           /* first unread byte in buf */
+    size_t len;             /* bytes in buf */
+    int eof;                /* true once there is nothing more to read */
+    char *line;             /* the line handed out by readcmd */
+    size_t linesize;        /* room in line */
+    long nread;             /* lines read so far, here-doc bodies too */
+};
+struct inbuf_t in;
+
+struct notes_t {            /* Job notifications waiting to be written */
+    char buf[NOTESIZE];     /* ring of complete lines */
+    size_t head;            /* bytes ever added */
+    size_t tail;            /* bytes ever written out */
+};
+struct notes_t notes;
+
+struct acct_t {             /* Resources used by a job */
+    double real;            /* seconds from launch to the last reap */
+    double user;            /* user CPU seconds of reaped processes */
+    double sys;             /* system CPU seconds of reaped processes */
+    long maxrss;            /* largest resident set of any process, in KB */
+};
+
+struct member_t {           /* One process of a job */
+    pid_t pid;              /* its PID */
+    int state;              /* M_RUN, M_STOP or M_DONE */
+};
 
 struct job_t {              /* The job struct */
-    pid_t pid;              /* job PID */
+    pid_t pid;              /* job PID (the process group ID) */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    char *cmdline;          /* command line */
+    struct member_t *members; /* every process in the job, stages first */
+    int nmembers;           /* number of processes in members */
+    int maxmembers;         /* room in members */
+    int nstages;            /* processes the shell started itself */
+    int nlive;              /* processes not yet reaped */
+    int nstopped;           /* live processes that are stopped */
+    int stopsig;            /* signal that last stopped a process */
+    int termsig;            /* signal that killed a process, or 0 */
+    struct timespec start;  /* when the first stage was started */
+    struct acct_t acct;     /* resources used by the reaped processes */
+    int timed;              /* print acct when the job finishes */
+    int status;             /* exit status of the last stage */
+    int cgfd;               /* the job's cgroup directory, or -1 */
+    long cgid;              /* names the cgroup: job<cgid> */
+    int qnext;              /* JID of the next queued job, 0 at the end */
+    char *runline;          /* a queued job's words, quoted to parse as they are */
+    int *heres;             /* here-doc and coproc fds of a queued job, in order */
+    int nheres;             /* number of them */
+    char *coname;           /* name a coproc job was started with, or NULL */
+    int cofds[2];           /* a coproc's stdout (read end) and stdin (write end) */
+};
+
+struct pidslot_t {          /* One entry of the PID index */
+    pid_t pid;              /* process ID, 0 if the slot is empty */
+    int jid;                /* job that owns the process */
+};
+
+struct jobs_t {             /* The job table */
+    struct job_t *byjid;    /* jobs indexed by JID, slot 0 unused */
+    int size;               /* number of slots in byjid */
+    int maxjid;             /* largest allocated job ID */
+    int fgjid;              /* JID of the foreground job, 0 if none */
+    int nbg;                /* jobs in the BG state */
+    int qhead, qtail;       /* first and last queued job, 0 if none */
+    int nqueued;            /* jobs in the queue */
+    struct pidslot_t *bypid;/* open-addressed PID -> JID index */
+    int pidmask;            /* size of bypid minus one (power of 2) */
+    int npids;              /* live entries in bypid */
+};
+struct jobs_t jobs;         /* The job list */
+struct acct_t finished;     /* totals over every finished job */
+int nfinished;              /* number of finished jobs */
+
+struct hashent_t {          /* A remembered command location */
+    char *name;             /* command name as typed */
+    char *path;             /* where it was found on PATH */
+    int hits;               /* times the location has been used */
+    struct hashent_t *next; /* next entry in the same bucket */
+};
+struct hashent_t *cmdhash[HASHSIZE]; /* The command hash */
+char *hashpath;             /* PATH the command hash was built from */
+
+struct redirop_t {          /* A redirection operator */
+    char *op;               /* token, e.g. ">>" */
+    int fd;                 /* file descriptor it redirects */
+    int flags;              /* open flags for the named file */
+    int kind;               /* REDIR_FILE, REDIR_DOC or REDIR_STR */
+};
+struct redirop_t redirops[] = {
+    { "<",   0, O_RDONLY, REDIR_FILE },
+    { ">",   1, O_WRONLY|O_TRUNC|O_CREAT, REDIR_FILE },
+    { ">>",  1, O_WRONLY|O_APPEND|O_CREAT, REDIR_FILE },
+    { "2>",  2, O_WRONLY|O_TRUNC|O_CREAT, REDIR_FILE },
+    { "<<",  0, 0, REDIR_DOC },
+    { "<<<", 0, 0, REDIR_STR },
+    { NULL, 0, 0, 0 }
+};
+
+struct redir_t {            /* A redirection of one pipeline stage */
+    struct redirop_t *op;   /* operator */
+    char *file;             /* file it names, or the here-doc delimiter */
+    int fd;                 /* file opened for it while launching */
+    int here;               /* here-doc memfd or coproc pipe, or -1 */
+};
+
+struct stage_t {            /* One command of a pipeline */
+    char **argv;            /* arguments, without the redirections */
+    struct redir_t *redirs; /* the stage's redirections */
+    int nredirs;            /* number of redirections */
+};
+
+struct pipeline_t {         /* A command line split at its pipes */
+    struct stage_t *stages; /* the commands, in order */
+    int nstages;            /* number of commands */
+    int bg;                 /* true if the line ended with & */
+};
+
+struct token_t {            /* One token of a command line */
+    int type;               /* TOK_WORD, TOK_PIPE, ... */
+    char *text;             /* the word, or the operator */
+    struct redirop_t *op;   /* the operator of a TOK_REDIR */
+};
+
+struct chunk_t {            /* One block of an arena */
+    struct chunk_t *next;   /* next block, reused after a release */
+    size_t size;            /* bytes in data */
+    char data[];            /* the memory handed out */
+};
+
+struct arena_t {            /* Memory released all at once, in LIFO order */
+    struct chunk_t *head;   /* first block */
+    struct chunk_t *cur;    /* block being handed out, NULL if none */
+    size_t used;            /* bytes of cur handed out */
+};
+struct arena_t arena;       /* Holds the tokens and pipelines being run */
+
+struct arenamark_t {        /* A point an arena can be released back to */
+    struct chunk_t *cur;
+    size_t used;
+};
+
+struct zygreq_t {           /* A launch request to the zygote */
+    pid_t pgid;             /* process group to join, 0 for a new one */
+    int argc;               /* number of arguments */
+    int nfds;               /* number of fds sent with the request */
+    int targets[ZYGFDS];    /* the fd each one becomes in the child */
+};                          /* followed by the path and the arguments */
+
+struct zygexec_t {          /* One launch, shared by the zygote and its child */
+    struct zygreq_t *req;   /* the request */
+    int *fds;               /* the fds sent with it */
+    char *path;             /* program to run */
+    char **argv;            /* its arguments */
+    int err;                /* errno the exec failed with, or 0 */
+};
+
+struct traceev_t {          /* One event in the -T trace ring */
+    int64_t ts;             /* when it began, ns on the monotonic clock */
+    int64_t dur;            /* how long it took in ns, or -1 for an instant */
+    const char *name;       /* the phase */
+    pid_t tid;              /* process it happened in */
+    pid_t pid;              /* process or job it concerns, or 0 */
+};
+
+struct tracering_t {        /* The -T trace ring, shared with forked children */
+    uint64_t next;          /* events recorded so far */
+    struct traceev_t ev[TRACERING];
+};
+struct tracering_t *tring;  /* the trace ring, or NULL without -T */
+int tracefd = -1;           /* the -T trace file */
+pid_t tracepid;             /* the shell, which writes the file at exit */
+
+/* Phase tracing; without -T each is one branch on tring */
+#define TRACE_BEGIN(t) do { if (tring != NULL) (t) = tracenow(); } while (0)
+#define TRACE_END(name, t, pid) do { if (tring != NULL) traceev(name, t, pid); } while (0)
+#define TRACE_MARK(name, pid) do { if (tring != NULL) traceev(name, -1, pid); } while (0)
+
+struct histrec_t {          /* One finished job in the history log (256 bytes) */
+    int64_t start;          /* when it was started, ns since the epoch */
+    int64_t end;            /* when its last process was reaped */
+    int64_t user;           /* user CPU time, us */
+    int64_t sys;            /* system CPU time, us */
+    int64_t maxrss;         /* largest resident set, KB */
+    int32_t pid;            /* job PID (the process group ID) */
+    int32_t jid;            /* job ID */
+    int32_t status;         /* exit status of the last stage */
+    int32_t termsig;        /* signal that killed a process, or 0 */
+    char cmdline[200];      /* command line, cut short if it is longer */
+};
+_Static_assert(sizeof(struct histrec_t) == 256, "history records are 256 bytes");
+
+struct histhdr_t {          /* Start of the history log, one record long */
+    char magic[8];          /* "tshhist" */
+    int32_t recsize;        /* sizeof(struct histrec_t) */
+    int32_t unused;
+    int64_t nrecs;          /* records written; bumped after each one is */
+};
+
+struct histlog_t {          /* The history log, mapped */
+    int fd;                 /* the log file, or -1 if there is none */
+    char *map;              /* the whole file */
+    size_t size;            /* bytes mapped */
+};
+struct histlog_t hist = {-1, NULL, 0};
+
+struct cgknob_t {           /* A cgroup v2 limit the limit builtin sets */
+    char *name;             /* name given to limit */
+    char *file;             /* interface file in a job's cgroup */
+    char *ctl;              /* controller that provides the file */
+    int enabled;            /* true if job cgroups get the controller */
+    char val[32];           /* value given to new jobs, "" for none */
+};
+struct cgknob_t cgknobs[] = {
+    {"cpu",  "cpu.max",    "cpu"},
+    {"mem",  "memory.max", "memory"},
+    {"pids", "pids.max",   "pids"},
+    {NULL}
+};
+int cgroot = -1;            /* the -g cgroup root directory, or -1 */
+int cgdir = -1;             /* this shell's cgroup under the root, or -1 */
+int cgprocs = -1;           /* cgroup.procs of the job being launched */
+long cgserial;              /* job cgroups made so far */
+
+struct builtin_t {          /* A builtin command, in the table built from builtins.def */
+    char *name;             /* command name, NULL for an empty slot */
+    void (*run)(char **argv); /* runs the command */
 };
-struct job_t jobs[MAXJOBS]; /* The job list */
 /* End global variables */
 
 
@@ -58,28 +357,134 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
+int parseline(char *cmdline, struct pipeline_t *pl, int *timed, int *heres);
+char *substitute(const char *cmd, size_t n, size_t *len);
 int builtin_cmd(char **argv);
+struct builtin_t *findbuiltin(char *name);
+void runbuiltin(struct stage_t *st);
 void do_bgfg(char **argv);
+void do_hash(char **argv);
+void do_jobs(char **argv);
+void do_quit(char **argv);
+void do_history(char **argv);
+void do_limit(char **argv);
+void do_jobsmax(char **argv);
+void do_coproc(char **argv);
 void waitfg(pid_t pid);
+pid_t launchjob(struct pipeline_t *pl, int state, char *cmdline, struct job_t *job);
+pid_t startqueued(struct job_t *job, int state);
+void drainqueue(void);
+pid_t forkstage(struct stage_t *st, int infd, int outfd, pid_t pgid);
+pid_t spawnstage(struct stage_t *st, int infd, int outfd, pid_t pgid);
+pid_t zygotestage(struct stage_t *st, int infd, int outfd, pid_t pgid);
+int passstage(struct pipeline_t *pl, int i);
+int elidecats(struct pipeline_t *pl, int *infd, int *outfd);
+pid_t teestage(struct stage_t *st, int infd, int outfd, pid_t pgid);
+pid_t parstage(struct stage_t *st, int infd, int outfd, pid_t pgid);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv); 
+void *arenaalloc(struct arena_t *a, size_t n);
+void arenamark(struct arena_t *a, struct arenamark_t *m);
+void arenarelease(struct arena_t *a, struct arenamark_t *m);
+int tokenize(struct arena_t *a, const char *cmdline, struct token_t **toks);
+struct token_t *growtoks(struct arena_t *a, struct token_t *t, int n, int *max);
+const char *matchparen(const char *p);
+struct redirop_t *redirop(char *tok);
+int parsepipeline(struct arena_t *a, struct token_t *toks, struct pipeline_t *pl);
+int readheres(struct pipeline_t *pl, int *heres);
+int readdoc(char *delim, int fd);
+void saveheres(struct pipeline_t *pl, struct job_t *job);
+char *quoteline(struct pipeline_t *pl);
+void quoteword(FILE *f, char *word);
+void closeheres(struct pipeline_t *pl);
+int openredir(struct redir_t *r);
+int mayblock(struct stage_t *st);
+int redirfailed(struct stage_t *st);
+int writeall(int fd, char *buf, size_t n);
+int splicen(int in, int out, ssize_t n);
+int splicetee(int in, int out, int *fds, int nfds);
+int sendall(int in, int out);
 void sigquit_handler(int sig);
+void sigusr1_handler(int sig);
+
+void initinput(char *script, char *cmd);
+void initevents(void);
+void initzygote(void);
+void zygote(int sock);
+int zygexec(void *arg);
+pid_t zygspawn(char *path, char **argv, pid_t pgid, int *fds, int *targets, int nfds);
+void readsignals(void);
+int waitinput(int timeout);
+char *readcmd(void);
+void notify(char *fmt, ...);
+void drainnotes(void);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs); 
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid); 
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid); 
+void initjob(struct job_t *job);
+void initjobs(struct jobs_t *jobs);
+int maxjid(struct jobs_t *jobs); 
+int pidhash(struct jobs_t *jobs, pid_t pid);
+struct pidslot_t *pidlookup(struct jobs_t *jobs, pid_t pid);
+void pidinsert(struct jobs_t *jobs, pid_t pid, int jid);
+void piddelete(struct jobs_t *jobs, pid_t pid, int jid);
+int addjob(struct jobs_t *jobs, pid_t pid, int state, char *cmdline);
+void addjobpid(struct jobs_t *jobs, struct job_t *job, pid_t pid);
+struct member_t *getmember(struct job_t *job, pid_t pid);
+void stopjob(struct job_t *job);
+int deletejob(struct jobs_t *jobs, pid_t pid); 
+void dropjob(struct jobs_t *jobs, struct job_t *job);
+void setjobstate(struct jobs_t *jobs, struct job_t *job, int state);
+pid_t fgpid(struct jobs_t *jobs);
+struct job_t *getjobpid(struct jobs_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct jobs_t *jobs, int jid); 
+struct job_t *getcoproc(struct jobs_t *jobs, char *name);
 int pid2jid(pid_t pid); 
-void listjobs(struct job_t *jobs);
+void listjobs(struct jobs_t *jobs, int longfmt);
+void dumpjobs(struct jobs_t *jobs);
+
+double tvsec(struct timeval *tv);
+double sincesec(struct timespec *start);
+void addrusage(struct acct_t *a, struct rusage *ru);
+void addacct(struct acct_t *sum, struct acct_t *a);
+void printacct(struct acct_t *a);
+void sprintacct(char *buf, struct acct_t *a);
+void shellacct(struct acct_t *a);
+void acctsummary(void);
+
+void inithist(char *file);
+int maphist(void);
+void histappend(struct job_t *job);
+int64_t histfind(struct histrec_t *recs, int64_t n, int64_t t);
+int parsewhen(char *s, int64_t *t);
+void printhist(int64_t i, struct histrec_t *rec);
+
+void inittrace(char *file);
+int64_t tracenow(void);
+void traceev(const char *name, int64_t start, pid_t pid);
+void flushtrace(void);
+
+void initcgroup(char *root);
+void exitcgroup(void);
+int cgwrite(int dirfd, char *file, char *val);
+int cgread(int dirfd, char *file, char *buf, size_t size);
+int makecgroup(long *cgid);
+void joincgroup(pid_t pid);
+void rmcgroup(struct job_t *job);
+struct cgknob_t *parseknob(char *arg, char *val);
+void printcgroup(struct job_t *job);
+
+unsigned hashname(char *name);
+void clearhash(void);
+struct hashent_t *hashcmd(char *name);
+void unhashcmd(char *name);
+void unhashstale(void);
+char *findcmd(char *name);
+void execcmd(char *path, char **argv, int stalefd);
+void listhash(void);
 
 void usage(void);
 void unix_error(char *msg);
@@ -87,13 +492,17 @@ void app_error(char *msg);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
 
+/* The builtin table, generated from builtins.def by mkbuiltins.pl */
+#include "builtins.h"
+
 /*
  * main - The shell's main routine 
  */
 int main(int argc, char **argv) 
 {
     char c;
-    char cmdline[MAXLINE];
+    char *cmdline;
+    char *cmd = NULL;    /* command string given with -c */
     int emit_prompt = 1; /* emit prompt (default) */
 
     /* Redirect stderr to stdout (so that driver will get all output
@@ -101,7 +510,7 @@ int main(int argc, char **argv)
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpl:zc:nH:g:j:T:")) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -112,43 +521,90 @@ int main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
 	    break;
+        case 'l':             /* choose the command launcher */
+            if (!strcmp(optarg, "fork"))
+                launcher = LAUNCH_FORK;
+            else if (!strcmp(optarg, "spawn"))
+                launcher = LAUNCH_SPAWN;
+            else if (!strcmp(optarg, "zygote"))
+                launcher = LAUNCH_ZYGOTE;
+            else
+                usage();
+	    break;
+        case 'z':             /* exec cat and tee like other commands */
+            fastpipes = 0;
+	    break;
+        case 'c':             /* run a command string, then exit */
+            cmd = optarg;
+	    break;
+        case 'n':             /* only parse the commands */
+            noexec = 1;
+	    break;
+        case 'H':             /* log finished jobs to a history file */
+            inithist(optarg);
+	    break;
+        case 'g':             /* run each job in a cgroup under this root */
+            initcgroup(optarg);
+	    break;
+        case 'j':             /* cap the jobs running in the background */
+            if ((maxbg = atoi(optarg)) < 1)
+                usage();
+	    break;
+        case 'T':             /* trace each command's phases to a file */
+            inittrace(optarg);
+	    break;
 	default:
             usage();
 	}
     }
+    if (optind < argc - 1 || (cmd != NULL && optind < argc))
+        usage();
 
-    /* Install the signal handlers */
+    /* Read commands from -c, a script file, or stdin. Scripts and
+     * command strings are never prompted for */
+    initinput(argv[optind], cmd);
+    if (in.eof)
+        emit_prompt = 0;
 
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
-    
- /* This one provides a clean way to kill the shell */
+    /* Output is flushed before a fork or a wait for input, so it can
+     * be fully buffered unless someone is watching a terminal */
+    if (!isatty(1))
+        setvbuf(stdout, NULL, _IOFBF, OUTBUFSIZE);
+
+    /* SIGINT, SIGTSTP, SIGCHLD and SIGUSR1 are read from a signalfd by
+     * the main loop, and their handlers run synchronously from there */
+    initevents();
+
+    /* The zygote is forked while the shell is still small, and with
+     * the shell's signals blocked */
+    if (launcher == LAUNCH_ZYGOTE)
+        initzygote();
+
+    /* This one provides a clean way to kill the shell */
     Signal(SIGQUIT, sigquit_handler); 
 
     /* Initialize the job list */
-    initjobs(jobs);
+    initjobs(&jobs);
 
     /* Execute the shell's read/eval loop */
     while (1) {
 
-	/* Read command line */
+	/* Read command line, after what the last one left to say */
+	drainnotes();
 	if (emit_prompt) {
 	    printf("%s", prompt);
-	    fflush(stdout);
 	}
-	if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-	    app_error("fgets error");
-	if (feof(stdin)) { /* End of file (ctrl-d) */
-	    fflush(stdout);
+	if ((cmdline = readcmd()) == NULL) { /* End of file (ctrl-d) */
+	    while (jobs.qhead != 0)	/* queued jobs have yet to start */
+		readsignals();
+	    drainnotes();
+	    if (verbose)
+		acctsummary();
 	    exit(0);
 	}
 
 	/* Evaluate the command line */
 	eval(cmdline);
-	fflush(stdout);
-	fflush(stdout);
     } 
 
     exit(0); /* control never reaches here */
@@ -158,600 +614,3815 @@ int main(int argc, char **argv)
  * eval - Evaluate the command line that the user has just typed in
  * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.  
+ * then execute it immediately, in the shell itself. A builtin that is
+ * one stage of a longer pipeline runs in a forked child instead, like
+ * any other stage. Otherwise, start each command of the
+ * pipeline in a child process and track them together as one job. If
+ * the job is running in the foreground, wait for it to terminate and
+ * then return.  Note: each job must have a unique process group ID so
+ * that our background children don't receive SIGINT (SIGTSTP) from
+ * the kernel when we type ctrl-c (ctrl-z) at the keyboard.  
+ *
+ * A line starting with the word time runs as usual, and prints the
+ * time and memory it used once it has finished. Under -j, a background
+ * job that would go over the limit is queued, to be started later.
 */
 void eval(char *cmdline) 
 {
-	char *argv[MAXARGS];
-	char buf[MAXLINE];
-	int bg;
+	struct arenamark_t mark;
+	struct pipeline_t pl;
+	struct acct_t before, after;
+	struct job_t *job;
+	int64_t t = 0;
 	pid_t pid;
-	
-	//create signal mask to block SIGCHLD signals later
-	sigset_t mask, pmask;
-	sigaddset(&mask, SIGCHLD);
-
-	//coppying cmdline to buf, bg set to 1/0 depending if '&' found in buf
-	strcpy(buf, cmdline);
-	bg = parseline(buf, argv);
-	
+	int timed, isbuiltin;
 
-	if (argv[0] == NULL){
-		return;
+	//everything parsed from this line goes back to the arena at the end
+	arenamark(&arena, &mark);
+	if (parseline(cmdline, &pl, &timed, NULL) < 0 || noexec){
+		goto out;
 	}
 	
-	//checking for builtin commands
-	if (!builtin_cmd(argv)){
-		//blocking SIGINT signals
-		sigprocmask(SIG_BLOCK, &mask, &pmask);
-		
-		//fork a child process
-		if ((pid = fork()) == 0){
-			
-			//--------------checking for redirects---------------
-			int i = 0;
-			while (argv[i] != NULL) {
-
-				//redirect next filename to be stdin
-				if (!strcmp(argv[i], "<")) {
-
-					//open file and set flags/permissions, returns file descriptor of file
-					int fd0 = open(argv[i+1], O_RDONLY);
-					//set file to stdin
-	    			dup2(fd0, 0);
-	    			//close file
-	    			close(fd0);
-	    			argv[i] = NULL;
-	    			argv[i+1] = NULL;
-	    			i=i+2;
-				} 
-				//redirect next filename to be stdout 
-				else if (!strcmp(argv[i], ">")) {
-
-					//open file and set flags/permissions, returns file descriptor of file
-					int fd1 = open(argv[i+1], O_WRONLY|O_TRUNC|O_CREAT, S_IRWXU|S_IRWXG|S_IRWXO);
-	    			//set file to stdout
-	    			dup2(fd1, 1);
-	    			close(fd1);
-	    			argv[i] = NULL;
-	    			argv[i+1] = NULL;
-	    			i=i+2;
-				}
-				//redirect next filename to be stdout, but append instead of overwrite
-				else if (!strcmp(argv[i], ">>")) {
-					int fd2 = open(argv[i+1], O_WRONLY|O_APPEND|O_CREAT, S_IRWXU|S_IRWXG|S_IRWXO);
-					dup2(fd2, 1);
-					close(fd2);
-					argv[i] = NULL;
-	    			argv[i+1] = NULL;
-	    			i=i+2;
-				}
-				//redirect stderr to next filename
-				else if (!strcmp(argv[i], "2>")) {
-					int fd3 = open(argv[i+1], O_WRONLY|O_CREAT,S_IRWXU|S_IRWXG|S_IRWXO|O_TRUNC);
-					//set file to stderr
-					dup2(fd3, 2);
-					close(fd3);
-					argv[i] = NULL;
-	    			argv[i+1] = NULL;
-	    			i=i+2;
-				}
-				else {
-					i++;
-				}	
-			}
-			//-------------end redirects------------
-
-			//unblock signals
-			sigprocmask(SIG_SETMASK, &pmask, NULL);
-			//setting the process's group id
-			setpgid(0,0);
-
-			//-------------piping-----------------
-			int numPipes = 0;
-			while (argv[i] != NULL) {			//Count number of pipes in command
-				if (!strcmp(argv[i], "|")) {
-					numPipes++;
-				}	
-			}
-
-			int p = 0;			//initialize iterator, pipe boolean, previous pipe index and previous pipe read fd
-			int finalPipeIndex = 0;
-			int isPipe = 0;
-			int prevPipe = 0;
-			while (argv[p] != NULL) {				//loop through command
-				
-				if (!strcmp(argv[p], "|")) {			//stop on pipe
-					isPipe = 1;	
-					int pd[2];			//initialize pipe
-			        	pipe(pd);
-					dup2(pd[0],0);			//set input of parent to read of pipe
-					argv[p] = NULL;
-					
-					
-		        		if (!fork()) {			//fork for command before pipe
-		            			dup2(pd[1], 1); 		// remap output back to parent
-		            			if(finalPipeIndex == 0) {	// edge case for first pipe
-							execve(argv[0], argv, environ);
-						} else {
-							dup2(prevPipe, 0);		//case for middle command (map previous pipe to stdin)
-							execve(argv[finalPipeIndex+1], &argv[finalPipeIndex + 1], environ);	//exec cammand after last pipe
-							close(prevPipe);		//close prev pipe
-						}
-					
-						close(pd[1]);
-						exit(0);
-			        }
-				
-				prevPipe = pd[0];			// store perious pipe read for next iteration 
-			        
-				//close unused pipes
-			        close(pd[1]);
-
-				//set pipe index to next pipe
-				finalPipeIndex = p;
-				}
-				p++;
-			}
-
-
-			//-------------end piping-----------------
-
-			//executing command
-			if(isPipe == 1){
-				//execute last command of pipes
-				execve(argv[finalPipeIndex + 1], &argv[finalPipeIndex+1], environ);
-				exit(0);
-			}else if (execve(argv[0], argv, environ) < 0) {
-				printf("%s: Command not found.\n", argv[0]);
-				exit(0);
-				
-			}
-			
+	//checking for builtin commands; a timed builtin is charged with
+	//what the shell and the children it reaped used meanwhile
+	TRACE_BEGIN(t);
+	isbuiltin = (pl.nstages == 1 && findbuiltin(pl.stages[0].argv[0]) != NULL);
+	TRACE_END("lookup", t, 0);
+	if (isbuiltin){
+		if (timed){
+			shellacct(&before);
+		}
+		TRACE_BEGIN(t);
+		runbuiltin(&pl.stages[0]);
+		TRACE_END("builtin", t, 0);
+		if (timed){
+			shellacct(&after);
+			after.real -= before.real;
+			after.user -= before.user;
+			after.sys -= before.sys;
+			printacct(&after);
 		}
+		goto out;
+	}
 
-		//if process in foreground
-		if (!bg) {
-			//add the job to the joblist
-			addjob(jobs, pid, FG, cmdline);
-			//unblock the signals
-			sigprocmask(SIG_SETMASK, &pmask, NULL);
-			//parent waits til child process finishes
-			waitfg(pid);
+	//with every background slot taken, the job waits its turn behind
+	//the ones already queued
+	if (pl.bg && maxbg > 0){
+		drainqueue();
+		drainnotes();
+		if (jobs.nbg >= maxbg){
+			addjob(&jobs, 0, QU, cmdline);
+			job = getjobjid(&jobs, jobs.maxjid);
+			job->timed = timed;
+			saveheres(&pl, job);	//its here-docs can't be read again
+			job->runline = quoteline(&pl);	//nor its substitutions run
+			printf("[%d] (-) Queued #%d %s", job->jid, jobs.nqueued, cmdline);
+			goto out;
 		}
-		//if process in background
-		else {
-			//add job to job the joblist
-			addjob(jobs, pid, BG, cmdline);
-			//unblock the signals
-			sigprocmask(SIG_SETMASK, &pmask, NULL);
-			printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
-		
-		}	
 	}
-    return;
-}
 
-/* 
- * parseline - Parse the command line and build the argv array.
- * 
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
- */
-int parseline(const char *cmdline, char **argv) 
-{
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line */
-    char *delim;                /* points to first space delimiter */
-    int argc;                   /* number of args */
-    int bg;                     /* background job? */
+	//no stage can be reaped before the job is added, since SIGCHLD
+	//is only ever read from sigfd
+	if ((pid = launchjob(&pl, pl.bg ? BG : FG, cmdline, NULL)) == 0){
+		goto out;
+	}
+	getjobpid(&jobs, pid)->timed = timed;
 
-    strcpy(buf, cmdline);
-    buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* ignore leading spaces */
-	buf++;
+	//if process in background
+	if (pl.bg) {
+		printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
+	}
 
-    /* Build the argv list */
-    argc = 0;
-    if (*buf == '\'') {
-	buf++;
-	delim = strchr(buf, '\'');
-    }
-    else {
-	delim = strchr(buf, ' ');
-    }
+	//if process in foreground, parent waits til the job finishes
+	if (!pl.bg) {
+		waitfg(pid);
+	}
 
-    while (delim) {
-	argv[argc++] = buf;
-	*delim = '\0';
-	buf = delim + 1;
-	while (*buf && (*buf == ' ')) /* ignore spaces */
-	       buf++;
+out:
+	closeheres(&pl);
+	arenarelease(&arena, &mark);
 
-	if (*buf == '\'') {
-	    buf++;
-	    delim = strchr(buf, '\'');
-	}
-	else {
-	    delim = strchr(buf, ' ');
+	//queued jobs a builtin let through start only now, when the
+	//builtin's redirections no longer stand in for the shell's fds
+	if (queuemoved){
+		queuemoved = 0;
+		drainqueue();
+		drainnotes();
 	}
-    }
-    argv[argc] = NULL;
-    
-    if (argc == 0)  /* ignore blank line */
-	return 1;
-
-    /* should the job run in the background? */
-    if ((bg = (*argv[argc-1] == '&')) != 0) {
-	argv[--argc] = NULL;
-    }
-    return bg;
 }
 
-/* 
- * builtin_cmd - If the user has typed a built-in command then execute
- *    it immediately.  
+/*
+ * parseline - Split a command line into tokens, then into the stages
+ *    and redirects of pl, all in the arena. A leading time is taken
+ *    off and reported in timed. Here-docs, here-strings and coproc
+ *    redirects get their fds from heres if it isn't NULL, else as
+ *    readheres describes. Returns -1 if there is nothing to run.
  */
-int builtin_cmd(char **argv) 
+int parseline(char *cmdline, struct pipeline_t *pl, int *timed, int *heres)
 {
-	//initializing strings to compare first string of cmdline
-	char bgStr[] = "bg";
-	char fgStr[] = "fg";
-	char quitStr[] = "quit";
-	char jobsStr[] = "jobs";
-	
-	if(!strcmp(argv[0], fgStr) | !strcmp(argv[0], bgStr)){	//fg or bg state (calls do_bgfg)
-		do_bgfg(argv);
-		return 1;
-	}else if(!strcmp(argv[0], quitStr)){		//quit state (exits)
-		exit(0);
-	}else if(!strcmp(argv[0], jobsStr)){		//job state (calls given listjobs())
-		listjobs(jobs);
-		return 1;
+	struct token_t *toks;
+	int64_t t = 0;
+	int rc = -1;
+
+	TRACE_BEGIN(t);
+	pl->nstages = 0;	//nothing for closeheres to close yet
+	if (tokenize(&arena, cmdline, &toks) <= 0){
+		goto out;
 	}
-    return 0;     /* not a builtin command */
+	//a leading time applies to the whole pipeline
+	if ((*timed = (toks[0].type == TOK_WORD && !strcmp(toks[0].text, "time")))){
+		toks++;
+	}
+	if (parsepipeline(&arena, toks, pl) < 0){
+		pl->nstages = 0;
+		goto out;
+	}
+	//the bodies follow the line, so they are read even under -n
+	if (readheres(pl, heres) < 0){
+		closeheres(pl);
+		pl->nstages = 0;
+		goto out;
+	}
+	rc = 0;
+out:
+	TRACE_END("parse", t, 0);
+	return rc;
 }
 
-/* 
- * do_bgfg - Execute the builtin bg and fg commands
+/*
+ * substitute - Run the n bytes at cmd, the inside of a $(...), and
+ *    return what it printed in a malloc'd buffer, less any trailing
+ *    newlines, with its length in *len. A lone builtin without
+ *    redirects runs in the shell, printing into a memory stream that
+ *    stands in for stdout, so nothing is forked. Anything else runs
+ *    as a foreground job with its stdout on a pipe, which is read
+ *    into a buffer that grows to fit. The command is parsed into the
+ *    same arena as the line it is part of, and gives back what it
+ *    used before returning, so substitutions can nest.
  */
-void do_bgfg(char **argv) 
+char *substitute(const char *cmd, size_t n, size_t *len)
 {
-	int jid;
+	struct arenamark_t mark;
+	struct pipeline_t pl;
+	struct pollfd pfd[2];
+	struct job_t *job;
+	char *line, *buf = NULL;
+	size_t size = 0;
+	ssize_t k;
+	FILE *mem, *saved;
+	int fds[2], fd, timed;
 	pid_t pid;
-	char *pidOrjid;
-
-	pidOrjid = argv[1];
 
-	//if command has nonexistent id after fg/bg
-	if (pidOrjid == NULL) {
-		printf("%s command requires PID or %%jobid argument\n", argv[0]);
-		return;
+	*len = 0;
+	arenamark(&arena, &mark);
+	line = arenaalloc(&arena, n + 2);	//a line of its own, for the job list
+	memcpy(line, cmd, n);
+	line[n] = '\n';
+	line[n+1] = '\0';
+	if (parseline(line, &pl, &timed, NULL) < 0){
+		goto out;
 	}
 
-	//checks if jid
-	if (pidOrjid[0] == '%') {
-
-		//second argument after '%' set to integer value of jid from argv
-		jid = atoi(&pidOrjid[1]);
-
-		//check if job is nonexistant
-		if(getjobjid(jobs, jid) == NULL){
-			printf("%s: No such job\n", pidOrjid);
-			return;
-		} else {
-			pid = getjobjid(jobs, jid)->pid;
+	//a builtin's printf output goes wherever stdout points
+	if (pl.nstages == 1 && pl.stages[0].nredirs == 0 && findbuiltin(pl.stages[0].argv[0]) != NULL){
+		fflush(stdout);
+		if ((mem = open_memstream(&buf, len)) == NULL){
+			unix_error("open_memstream error");
+		}
+		saved = stdout;
+		stdout = mem;
+		builtin_cmd(pl.stages[0].argv);
+		stdout = saved;
+		fclose(mem);
+		goto out;
+	}
 
-			//send continue signal
-			kill(-pid, SIGCONT);
+	//the pipe stands in for the shell's stdout while the job starts,
+	//after everything meant for the real one has gone there
+	if (pipe2(fds, O_CLOEXEC) < 0){
+		unix_error("pipe error");
+	}
+	fflush(stdout);
+	drainnotes();
+	fd = fcntl(1, F_DUPFD_CLOEXEC, 10);
+	dup2(fds[1], 1);
+	close(fds[1]);
+	pid = launchjob(&pl, FG, line, NULL);
+	dup2(fd, 1);
+	close(fd);
 
-			//if fg input, set bg process state to fg
-			if (!strcmp("fg", argv[0])) {
-				getjobpid(jobs, pid)->state = FG;
-				waitfg(pid);
+	//reading until the last writer is gone, running the handlers
+	//meanwhile, so ctrl-c and ctrl-z still reach the job
+	pfd[0].fd = fds[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sigfd;
+	pfd[1].events = POLLIN;
+	while (pid != 0){
+		if (*len + PUMPCHUNK > size){
+			size = 2 * (*len + PUMPCHUNK);
+			if ((buf = realloc(buf, size)) == NULL){
+				unix_error("realloc error");
 			}
-
-			//if bg input, set fg process state to bg
-			if (!strcmp("bg", argv[0])) {
-				struct job_t *job;
-				job = getjobpid(jobs, pid);
-				printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
-				job->state = BG;
+		}
+		if (poll(pfd, 2, -1) < 0){
+			if (errno == EINTR){
+				continue;
 			}
+			unix_error("poll error");
 		}
-	} 
-	//checks if pid
-	else if(isdigit(pidOrjid[0])) {
-
-		//get integer value of pid from argv
-		pid = atoi(pidOrjid);
-
-		//check if job is nonexistant
-		if(getjobpid(jobs, pid) == NULL){
-			printf("(%d): No such process\n", pid);
-			return;
+		if (pfd[1].revents & POLLIN){
+			readsignals();
 		}
-
-		//send continue signal
-		kill(-pid, SIGCONT);
-
-		//if fg input, set bg process state to fg
-		if (!strcmp("fg", argv[0])) {
-			getjobpid(jobs, pid)->state = FG;
-			waitfg(pid);
+		if ((job = getjobpid(&jobs, pid)) != NULL && job->state == ST){
+			break;		//a stopped job won't write any more for now
 		}
-
-		//if bg input, set fg process state to bg
-		if (!strcmp("bg", argv[0])) {
-			struct job_t *job;
-			job = getjobpid(jobs, pid);
-			printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
-			job->state = BG;
+		if (pfd[0].revents == 0){
+			continue;
+		}
+		if ((k = read(fds[0], buf + *len, size - *len)) < 0 && errno == EINTR){
+			continue;
+		}
+		if (k <= 0){
+			break;
 		}
+		*len += k;
+	}
+	close(fds[0]);
+	if (pid != 0){
+		waitfg(pid);
+	}
 
-	} else {
-		//argv[0] equals FG/BG
-		printf("%s: argument must be a PID or %%jobid\n", argv[0]);
-		return;
+out:
+	while (*len > 0 && buf[*len - 1] == '\n'){
+		(*len)--;
 	}
+	closeheres(&pl);
+	arenarelease(&arena, &mark);
+	return buf;
 }
 
-/* 
- * waitfg - Block until process pid is no longer the foreground process
+/*
+ * arenaalloc - Hand out n bytes from arena a. Blocks are only ever
+ *    added, never freed, so once the arena has grown to fit the
+ *    longest command line it stops calling malloc.
  */
-void waitfg(pid_t pid)
+void *arenaalloc(struct arena_t *a, size_t n)
 {
-	int doesJobExist = 0;
-	int i;
-	for (i=0; i<MAXJOBS; i++){		//loops through job list
-		if (jobs[i].pid == pid){
-			doesJobExist = 1;		//if pid is in joblist, condition set to true
-			break;
-		}
-	}
-	if(doesJobExist){
-		while(pid == fgpid(jobs)){
-			sleep(1);					//busy while loop until fg job is no longer in list
-		}
+    struct chunk_t *c, **link;
+
+    n = (n + 15) & ~(size_t)15;
+    if (a->cur == NULL || a->used + n > a->cur->size) {
+	/* Move on to the next free block that is big enough */
+	link = (a->cur == NULL) ? &a->head : &a->cur->next;
+	for (c = *link; c != NULL && c->size < n; c = c->next)
+	    ;
+	if (c == NULL) {
+	    size_t size = (n > ARENACHUNK) ? n : ARENACHUNK;
+	    if ((c = malloc(sizeof(struct chunk_t) + size)) == NULL)
+		unix_error("malloc error");
+	    c->size = size;
+	    c->next = *link;
+	    *link = c;
 	}
-    return;
+	a->cur = c;
+	a->used = 0;
+    }
+    a->used += n;
+    return a->cur->data + a->used - n;
 }
 
-/*****************
- * Signal handlers
- *****************/
+/* arenamark - Remember how much of arena a is in use */
+void arenamark(struct arena_t *a, struct arenamark_t *m)
+{
+    m->cur = a->cur;
+    m->used = a->used;
+}
+
+/* arenarelease - Give back everything allocated since mark m */
+void arenarelease(struct arena_t *a, struct arenamark_t *m)
+{
+    a->cur = m->cur;
+    a->used = m->used;
+}
 
 /* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.  
+ * tokenize - Split the command line into words and operators in one
+ *    pass, storing the tokens in an array in arena a that ends with a
+ *    TOK_END token. The operators |, &, <, >, >>, 2>, << and <<< need
+ *    no blanks around them. A word can quote blanks and operators with '...',
+ *    with "..." (inside which \", \\ and \$ are escapes), or by putting a
+ *    backslash in front of the character; other backslashes are kept
+ *    as typed. Outside '...', $(command) is replaced by what the
+ *    command prints (see substitute), which is split into words at
+ *    blanks and newlines unless it is inside "...". Words are unquoted
+ *    into a copy of the line, which only has to grow to make room for
+ *    a substitution. Returns the number of tokens, or -1 after
+ *    reporting a syntax error.
  */
-void sigchld_handler(int sig) 
+int tokenize(struct arena_t *a, const char *cmdline, struct token_t **toks)
 {
-	pid_t pid;
-	int status;
-	//WNOHANG returns immediately if no child exits, WUNTRACED returns if child has stopped
-	while((pid = waitpid(-1, &status, WNOHANG|WUNTRACED)) > 0){
-		if (WIFEXITED(status) != 0){		//true if child has terminated normally
-			deletejob(jobs, pid);		//deletes terminated job
-		}
-		if (WIFSTOPPED(status) != 0){ //true if child process was stopped by delivery of signal
-			getjobpid(jobs, pid)->state = ST; //change state to stopped
-			printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid), pid, WSTOPSIG(status));
+    const char *p = cmdline, *end;
+    char *out = arenaalloc(a, strlen(cmdline) + 1);
+    char *sub, *word;
+    struct token_t *t = NULL;
+    struct redirop_t *op, *best;
+    int n = 0, max = 0, keep;
+    size_t i, k, len;
+    char q;
+
+    while (1) {
+	while (*p == ' ' || *p == '\t' || *p == '\n')
+	    p++;
+
+	/* Make room for this token and the TOK_END after it */
+	t = growtoks(a, t, n, &max);
+	if (*p == '\0')
+	    break;
+	t[n].op = NULL;
+
+	/* Operators */
+	if (*p == '|' || *p == '&') {
+	    t[n].type = (*p == '|') ? TOK_PIPE : TOK_BG;
+	    t[n++].text = (*p++ == '|') ? "|" : "&";
+	    continue;
+	}
+	if (*p == '<' || *p == '>' || *p == '2') {
+	    best = NULL;
+	    for (op = redirops; op->op != NULL; op++)
+		if (!strncmp(p, op->op, strlen(op->op)) &&
+		    (best == NULL || strlen(op->op) > strlen(best->op)))
+		    best = op;
+	    if (best != NULL) {
+		t[n].type = TOK_REDIR;
+		t[n].op = best;
+		t[n++].text = best->op;
+		p += strlen(best->op);
+		continue;
+	    }
+	}
+
+	/* A word runs to the next unquoted blank or operator. q is the
+	 * quote it is inside, if any, and keep is set once it has had
+	 * quotes, which make it a word even if it is empty */
+	t[n].type = TOK_WORD;
+	t[n++].text = out;
+	keep = 0;
+	q = 0;
+	while (*p != '\0' && (q != 0 || !strchr(" \t\n|&<>", *p))) {
+	    if (*p == '$' && p[1] == '(' && q != '\'') {
+		if ((end = matchparen(p + 2)) == NULL) {
+		    printf("Unmatched (.\n");
+		    return -1;
 		}
-		if (WIFSIGNALED(status)){ //true if child process was terminated by delivery of signal
-			printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid), pid, WTERMSIG(status));
-			deletejob(jobs, pid);	//deletes terminated job
+		len = 0;
+		sub = noexec ? NULL : substitute(p + 2, end - (p + 2), &len);
+		p = end + 1;
+
+		/* The word so far moves to a buffer with room for the
+		 * output as well as the rest of the line */
+		k = out - t[n-1].text;
+		word = arenaalloc(a, k + len + strlen(p) + 1);
+		memcpy(word, t[n-1].text, k);
+		t[n-1].text = word;
+		out = word + k;
+		for (i = 0; i < len; i++) {
+		    if (q == 0 && (sub[i] == ' ' || sub[i] == '\t' || sub[i] == '\n')) {
+			if (out == t[n-1].text && !keep)
+			    continue;
+			*out++ = '\0';
+			t = growtoks(a, t, n, &max);
+			t[n].type = TOK_WORD;
+			t[n].op = NULL;
+			t[n++].text = out;
+			keep = 0;
+		    }
+		    else if (sub[i] != '\0') {
+			*out++ = sub[i];
+		    }
 		}
+		free(sub);
+	    }
+	    else if (q == 0 && *p == '\\' && p[1] != '\0' && strchr(" \t\n|&<>'\"\\$", p[1])) {
+		if (*++p != '\n')	/* backslash-newline is dropped */
+		    *out++ = *p;
+		p++;
+	    }
+	    else if (q == '"' && *p == '\\' && p[1] != '\0' && strchr("\"\\$", p[1])) {
+		*out++ = p[1];
+		p += 2;
+	    }
+	    else if (q == 0 && (*p == '\'' || *p == '"')) {
+		q = *p++;
+		keep = 1;
+	    }
+	    else if (*p == q) {
+		q = 0;
+		p++;
+	    }
+	    else {
+		*out++ = *p++;
+	    }
 	}
-    return;
+	if (q != 0) {
+	    printf("Unmatched %c.\n", q);
+	    return -1;
+	}
+	if (out == t[n-1].text && !keep)	/* a substitution that printed nothing */
+	    n--;
+	else
+	    *out++ = '\0';
+    }
+
+    t[n].type = TOK_END;
+    t[n].text = NULL;
+    t[n].op = NULL;
+    *toks = t;
+    return n;
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.  
+/*
+ * growtoks - Return the token array t, which holds n tokens in room
+ *    for *max, or a bigger copy of it, with room for at least two more
  */
-void sigint_handler(int sig) 
+struct token_t *growtoks(struct arena_t *a, struct token_t *t, int n, int *max)
 {
-	int i=0;
-	//finding foreground job
-	for(i=0;i<MAXJOBS;i++){		//loops through jobs until pid = 0 (last job)
-		if(jobs[i].pid != 0){
-			if(jobs[i].state == FG){		//finds job in FG
-				kill(-jobs[i].pid, sig);		//send kill to gpid for fg jobs
-				return;
-			}
-		}
-	}
+    struct token_t *old = t;
+
+    if (n + 2 <= *max)
+	return t;
+    *max = *max ? 2 * *max : 32;
+    t = arenaalloc(a, *max * sizeof(struct token_t));
+    if (n > 0)
+	memcpy(t, old, n * sizeof(struct token_t));
+    return t;
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+ * matchparen - Find the ) that closes a $( whose inside starts at p,
+ *    passing over nested parentheses and anything quoted. Returns
+ *    NULL if there is none.
  */
-void sigtstp_handler(int sig) 
+const char *matchparen(const char *p)
 {
+    int depth = 0;
+    char q;
 
-	int i=0;
-	//finding foreground job
-	for(i=0;i<MAXJOBS;i++){
-		if(jobs[i].state == FG){
-			if(jobs[i].pid != 0){
-				//sending SIGTSTP signal to foreground job
-				kill(-jobs[i].pid, sig);
-				return;
+    for (; *p != '\0'; p++) {
+	if (*p == '\\' && p[1] != '\0')
+	    p++;
+	else if (*p == '\'' || *p == '"') {
+	    for (q = *p++; *p != q; p++) {
+		if (*p == '\0')
+		    return NULL;
+		if (q == '"' && *p == '\\' && p[1] != '\0')
+		    p++;
+	    }
+	}
+	else if (*p == '(')
+	    depth++;
+	else if (*p == ')' && depth-- == 0)
+	    return p;
+    }
+    return NULL;
+}
+
+/*
+ * parsepipeline - Split the tokens of a command line into the stages
+ *    of a pipeline, building each stage's argv and redirs in arena a.
+ *    A trailing & sets pl->bg. Returns 0, or -1 after reporting a
+ *    syntax error.
+ */
+int parsepipeline(struct arena_t *a, struct token_t *toks, struct pipeline_t *pl)
+{
+    struct stage_t *st;
+    struct token_t *t, *end;
+    int i, nwords, nredirs;
+
+    pl->nstages = 1;
+    pl->bg = 0;
+    for (t = toks; t->type != TOK_END; t++)
+	if (t->type == TOK_PIPE)
+	    pl->nstages++;
+    pl->stages = arenaalloc(a, pl->nstages * sizeof(struct stage_t));
+
+    for (i = 0, t = toks; i < pl->nstages; i++, t = end + 1) {
+	st = &pl->stages[i];
+
+	/* Size up the stage, which ends at the next |, & or the end */
+	nwords = nredirs = 0;
+	for (end = t; end->type == TOK_WORD || end->type == TOK_REDIR; end++) {
+	    if (end->type == TOK_WORD) {
+		nwords++;
+		continue;
+	    }
+	    if ((++end)->type != TOK_WORD) {
+		printf("Missing name for redirect.\n");
+		return -1;
+	    }
+	    nredirs++;
+	}
+	if (nwords == 0) {	/* nothing to run in this stage */
+	    printf("Invalid null command.\n");
+	    return -1;
+	}
+	if (end->type == TOK_BG) {
+	    if (end[1].type != TOK_END) {
+		printf("Syntax error near &.\n");
+		return -1;
+	    }
+	    pl->bg = 1;
+	}
+
+	/* Then fill in its argv and redirects */
+	st->argv = arenaalloc(a, (nwords + 1) * sizeof(char *));
+	st->redirs = arenaalloc(a, nredirs * sizeof(struct redir_t));
+	st->nredirs = 0;
+	for (nwords = 0; t < end; t++) {
+	    if (t->type == TOK_WORD) {
+		st->argv[nwords++] = t->text;
+		continue;
+	    }
+	    st->redirs[st->nredirs].op = t->op;
+	    st->redirs[st->nredirs].file = (++t)->text;
+	    st->redirs[st->nredirs].fd = -1;
+	    st->redirs[st->nredirs].here = -1;
+	    st->nredirs++;
+	}
+	st->argv[nwords] = NULL;
+    }
+    return 0;
+}
+
+/*
+ * readheres - Give each here-doc and here-string redirect of pl a
+ *    memfd holding its text, so the command reads it as stdin without
+ *    a temporary file or a pipe for the shell to keep fed, and each
+ *    redirect to or from %name a copy of coproc name's stdin or
+ *    stdout pipe. A queued job being started passes the fds it was
+ *    given in heres, in order. Otherwise a here-string's memfd gets
+ *    the word and a newline, and a here-doc's gets the input lines
+ *    that follow the command line, up to its delimiter. Returns 0, or
+ *    -1 after reporting a coproc that doesn't exist; every here-doc
+ *    is read either way.
+ */
+int readheres(struct pipeline_t *pl, int *heres)
+{
+    struct stage_t *st;
+    struct redir_t *r;
+    struct job_t *job;
+    struct iovec iov[2];
+    int err, rc = 0;
+
+    for (st = pl->stages; st < pl->stages + pl->nstages; st++)
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+	    if (r->op->kind == REDIR_FILE && r->file[0] != '%')
+		continue;
+	    if (heres != NULL) {
+		r->here = *heres++;
+		continue;
+	    }
+	    if (r->op->kind == REDIR_FILE) {
+		if ((job = getcoproc(&jobs, r->file + 1)) == NULL) {
+		    printf("%s: No such coproc\n", r->file);
+		    rc = -1;
+		    continue;
+		}
+		r->here = fcntl(job->cofds[r->op->fd == 0 ? 0 : 1], F_DUPFD_CLOEXEC, 0);
+		continue;
+	    }
+	    if ((r->here = memfd_create("tsh.here", MFD_CLOEXEC)) < 0)
+		unix_error("memfd_create error");
+	    if (r->op->kind == REDIR_STR) {
+		iov[0].iov_base = r->file;
+		iov[0].iov_len = strlen(r->file);
+		iov[1].iov_base = "\n";
+		iov[1].iov_len = 1;
+		err = (writev(r->here, iov, 2) < 0) ? errno : 0;
+	    } else {
+		err = readdoc(r->file, r->here);
+	    }
+	    if (err != 0)
+		printf("here-document: %s\n", strerror(err));
+	    lseek(r->here, 0, SEEK_SET);
+	}
+    return rc;
+}
+
+/*
+ * readdoc - Copy the input lines that follow the command line to fd,
+ *    up to a line that is just delim, which is consumed but not
+ *    copied. Lines are written straight from the input buffer, as
+ *    many as it holds at a time, so a long body costs a write per
+ *    refill rather than one per line. Only the start of a line that
+ *    could still be the delimiter is kept back across a refill. A
+ *    body cut short by the end of input keeps what there is. Returns
+ *    0, or the errno of a write that failed, after which the rest of
+ *    the body is still consumed.
+ */
+int readdoc(char *delim, int fd)
+{
+    size_t dlen = strlen(delim), n;
+    char *s, *p, *nl;
+    int midline = 0, err = 0;  /* midline: the line's start is written */
+    ssize_t rc;
+
+    while (1) {
+	/* Pass over the whole lines buffered, looking for delim */
+	s = in.buf + in.start;
+	n = in.len - in.start;
+	for (p = s; (nl = memchr(p, '\n', s + n - p)) != NULL; p = nl + 1) {
+	    in.nread++;
+	    if (!midline && nl - p == dlen && !memcmp(p, delim, dlen)) {
+		if (!err && writeall(fd, s, p - s) < 0)
+		    err = errno;
+		in.start += nl + 1 - s;
+		return err;
+	    }
+	    midline = 0;
+	}
+
+	/* A last line without a newline may be the delimiter too */
+	if (in.eof) {
+	    if (p < s + n)
+		in.nread++;
+	    if (midline || s + n - p != dlen || memcmp(p, delim, dlen))
+		p = s + n;
+	    if (!err && writeall(fd, s, p - s) < 0)
+		err = errno;
+	    in.start = in.len;
+	    return err;
+	}
+
+	/* Write all but a partial line that could still be delim, which
+	 * moves to the front of the buffer for the refill to follow */
+	if (s + n - p > dlen)
+	    midline = 1;
+	if (midline)
+	    p = s + n;
+	if (!err && writeall(fd, s, p - s) < 0)
+	    err = errno;
+	memmove(in.buf, p, s + n - p);
+	in.len = s + n - p;
+	in.start = 0;
+	fflush(stdout);
+	drainnotes();
+	if (!waitinput(-1))
+	    continue;
+	if ((rc = read(0, in.buf + in.len, INBUFSIZE - in.len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read error");
+	}
+	if (rc == 0)
+	    in.eof = 1;
+	in.len += rc;
+    }
+}
+
+/*
+ * saveheres - Move the fds readheres gave pl's redirects to a job
+ *    being queued, whose command line is parsed again when it starts
+ */
+void saveheres(struct pipeline_t *pl, struct job_t *job)
+{
+    struct stage_t *st;
+    struct redir_t *r;
+
+    for (st = pl->stages; st < pl->stages + pl->nstages; st++)
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+	    if (r->here < 0)
+		continue;
+	    if ((job->heres = realloc(job->heres, (job->nheres + 1) * sizeof(int))) == NULL)
+		unix_error("realloc error");
+	    job->heres[job->nheres++] = r->here;
+	    r->here = -1;
+	}
+}
+
+/*
+ * quoteline - Write pl out again as a command line with every word
+ *    single-quoted, so that parsing it gives back the same words
+ *    without running its substitutions a second time. The caller
+ *    frees the line.
+ */
+char *quoteline(struct pipeline_t *pl)
+{
+    struct stage_t *st;
+    struct redir_t *r;
+    char **argv, *line = NULL;
+    size_t len = 0;
+    FILE *f;
+
+    if ((f = open_memstream(&line, &len)) == NULL)
+	unix_error("open_memstream error");
+    for (st = pl->stages; st < pl->stages + pl->nstages; st++) {
+	if (st > pl->stages)
+	    fputs(" |", f);
+	for (argv = st->argv; *argv != NULL; argv++)
+	    quoteword(f, *argv);
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+	    fprintf(f, " %s", r->op->op);
+	    quoteword(f, r->file);
+	}
+    }
+    fputs(pl->bg ? " &\n" : "\n", f);
+    fclose(f);
+    return line;
+}
+
+/* quoteword - Write a blank and word to f in single quotes */
+void quoteword(FILE *f, char *word)
+{
+    fputs(" '", f);
+    for (; *word != '\0'; word++) {
+	if (*word == '\'')
+	    fputs("'\\''", f);
+	else
+	    fputc(*word, f);
+    }
+    fputc('\'', f);
+}
+
+/* closeheres - Close the fds readheres gave pl once it has started */
+void closeheres(struct pipeline_t *pl)
+{
+    struct stage_t *st;
+    struct redir_t *r;
+
+    for (st = pl->stages; st < pl->stages + pl->nstages; st++)
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++)
+	    if (r->here >= 0) {
+		close(r->here);
+		r->here = -1;
+	    }
+}
+
+/*
+ * redirop - Return the redirection operator named by tok, or NULL if
+ *    tok is not one
+ */
+struct redirop_t *redirop(char *tok)
+{
+    struct redirop_t *op;
+
+    for (op = redirops; op->op != NULL; op++)
+	if (!strcmp(tok, op->op))
+	    return op;
+    return NULL;
+}
+
+/*
+ * openredir - Open the file a redirection names, close-on-exec, or
+ *    dup the fd readheres gave it. Returns the fd, or -1 after
+ *    reporting the error.
+ */
+int openredir(struct redir_t *r)
+{
+    int64_t t = 0;
+    int fd;
+
+    TRACE_BEGIN(t);
+    if (r->here >= 0)
+	fd = fcntl(r->here, F_DUPFD_CLOEXEC, 0);
+    else
+	fd = open(r->file, r->op->flags|O_CLOEXEC, REDIR_MODE);
+    TRACE_END("redirect", t, 0);
+    if (fd < 0)
+	printf("%s: %s\n", r->file, strerror(errno));
+    return fd;
+}
+
+/*
+ * mayblock - Return true if opening one of st's redirect files could
+ *    block the opener, as a FIFO does until its other end is opened
+ */
+int mayblock(struct stage_t *st)
+{
+    struct redir_t *r;
+    struct stat sb;
+
+    for (r = st->redirs; r < st->redirs + st->nredirs; r++)
+	if (r->here < 0 && stat(r->file, &sb) == 0 && S_ISFIFO(sb.st_mode))
+	    return 1;
+    return 0;
+}
+
+/*
+ * redirfailed - After a child that opened st's redirect files failed
+ *    to start, open them again to see whether one of them was why.
+ *    Returns 1 after reporting the first that can't be opened, else 0.
+ */
+int redirfailed(struct stage_t *st)
+{
+    struct redir_t *r;
+    int fd;
+
+    for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+	if (r->here >= 0)
+	    continue;
+	if ((fd = openredir(r)) < 0)
+	    return 1;
+	close(fd);
+    }
+    return 0;
+}
+
+/*
+ * splicen - Move exactly n bytes from pipe in to out with splice(2),
+ *    falling back to read and write if out cannot be spliced to.
+ *    Returns 0, or -1 on error.
+ */
+int splicen(int in, int out, ssize_t n)
+{
+    char buf[PUMPCHUNK];
+    ssize_t k, w, done;
+
+    while (n > 0) {
+	k = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE);
+	if (k < 0 && errno == EINVAL) {
+	    if ((k = read(in, buf, n < PUMPCHUNK ? n : PUMPCHUNK)) <= 0)
+		return -1;
+	    for (done = 0; done < k; done += w)
+		if ((w = write(out, buf + done, k - done)) < 0)
+		    return -1;
+	}
+	if (k <= 0)
+	    return -1;
+	n -= k;
+    }
+    return 0;
+}
+
+/*
+ * sendall - Copy the whole of file in to out with sendfile(2), falling
+ *    back to read and write if out can't take it (a file opened for
+ *    appending, say). Returns 0, or -1 on error.
+ */
+int sendall(int in, int out)
+{
+    char buf[PUMPCHUNK];
+    off_t off = 0, len = lseek(in, 0, SEEK_END);
+    ssize_t k, w, done;
+
+    while (off < len) {
+	k = sendfile(out, in, &off, len - off);
+	if (k < 0 && (errno == EINVAL || errno == ENOSYS)) {
+	    if ((k = pread(in, buf, len - off < PUMPCHUNK ? len - off : PUMPCHUNK, off)) <= 0)
+		return -1;
+	    for (done = 0; done < k; done += w)
+		if ((w = write(out, buf + done, k - done)) < 0)
+		    return -1;
+	    off += k;
+	}
+	if (k <= 0)
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * writeall - Write all n bytes of buf to fd. Returns 0, or -1 on error.
+ */
+int writeall(int fd, char *buf, size_t n)
+{
+    ssize_t k;
+
+    while (n > 0) {
+	if ((k = write(fd, buf, n)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf += k;
+	n -= k;
+    }
+    return 0;
+}
+
+/*
+ * splicetee - Copy everything from pipe in to each of the files and
+ *    to out. Each round tee(2)s what is buffered in the input into a
+ *    scratch pipe once per file and splices it on, then splices the
+ *    input itself to out. Returns 0 at end of input, or -1 on error.
+ */
+int splicetee(int in, int out, int *fds, int nfds)
+{
+    int scratch[2];
+    ssize_t n, len = PUMPCHUNK;
+    int i;
+
+    if (pipe(scratch) < 0)
+	return -1;
+    while (1) {
+	for (i = 0; i < nfds; i++) {
+	    if ((n = tee(in, scratch[1], len, 0)) <= 0)
+		return n;
+	    len = n;
+	    if (splicen(scratch[0], fds[i], n) < 0)
+		return -1;
+	}
+	if (splicen(in, out, len) < 0)
+	    return -1;
+	len = PUMPCHUNK;
+    }
+}
+
+/* 
+ * builtin_cmd - If the user has typed a built-in command then execute
+ *    it immediately. Builtins are listed in builtins.def.
+ */
+int builtin_cmd(char **argv) 
+{
+	struct builtin_t *b;
+
+	if ((b = findbuiltin(argv[0])) == NULL){
+		return 0;     /* not a builtin command */
+	}
+	b->run(argv);
+	return 1;
+}
+
+/*
+ * findbuiltin - Look a command name up in the builtin table. The
+ *    table is a perfect hash, so only the one slot the name hashes to
+ *    can hold it. Returns NULL if the name isn't a builtin.
+ */
+struct builtin_t *findbuiltin(char *name)
+{
+	unsigned h = 2166136261u ^ BUILTIN_SEED;	//FNV-1a, as in mkbuiltins.pl
+	struct builtin_t *b;
+	char *p;
+
+	for (p = name; *p; p++){
+		h ^= (unsigned char)*p;
+		h *= 16777619u;
+	}
+	b = &builtins[h & (BUILTIN_SLOTS - 1)];
+	if (b->name == NULL || strcmp(b->name, name)){
+		return NULL;
+	}
+	return b;
+}
+
+/*
+ * runbuiltin - Run a builtin stage in the shell itself, with its
+ *    redirects applied for as long as it runs. Each fd a redirect
+ *    replaces is first saved to a close-on-exec fd above the standard
+ *    ones, and is put back afterwards.
+ */
+void runbuiltin(struct stage_t *st)
+{
+	int *saved = arenaalloc(&arena, st->nredirs * sizeof(int));
+	struct redir_t *r;
+	int i, fd;
+
+	//output written so far belongs on the old fds
+	fflush(stdout);
+	for (i = 0; i < st->nredirs; i++){
+		r = &st->redirs[i];
+		if ((fd = openredir(r)) < 0){
+			break;
+		}
+		saved[i] = fcntl(r->op->fd, F_DUPFD_CLOEXEC, 10);	//-1 if it wasn't open
+		dup2(fd, r->op->fd);
+		close(fd);
+	}
+	if (i == st->nredirs){
+		builtin_cmd(st->argv);
+	}
+	fflush(stdout);
+
+	//putting the fds back, last redirect first
+	while (--i >= 0){
+		r = &st->redirs[i];
+		if (saved[i] < 0){
+			close(r->op->fd);
+		}else{
+			dup2(saved[i], r->op->fd);
+			close(saved[i]);
+		}
+	}
+}
+
+/*
+ * do_quit - Execute the builtin quit command
+ */
+void do_quit(char **argv)
+{
+	drainnotes();
+	if (verbose){
+		acctsummary();
+	}
+	exit(0);
+}
+
+/*
+ * do_jobs - Execute the builtin jobs command: -l adds what each job
+ *    has used so far, and -m prints the table for a program to read
+ */
+void do_jobs(char **argv)
+{
+	if (argv[1] == NULL){
+		listjobs(&jobs, 0);
+	}else if (!strcmp(argv[1], "-l") && argv[2] == NULL){
+		listjobs(&jobs, 1);
+	}else if (!strcmp(argv[1], "-m") && argv[2] == NULL){
+		dumpjobs(&jobs);
+	}else{
+		printf("jobs: usage: jobs [-l | -m]\n");
+	}
+}
+
+/*
+ * do_history - Execute the builtin history command, which lists the
+ *    most recent finished jobs in the history log: all of them with -a,
+ *    or the last n with -n n (20 by default). -s and -u limit them to
+ *    jobs that finished in a time range, each given as @epoch-seconds
+ *    or as a time ago like 90s, 30m, 2h or 1d. -f keeps only jobs that
+ *    failed, and -e n only jobs whose last stage exited with n.
+ *    The range is found by binary search, and the log is read from the
+ *    newest end, so only the records that are shown or skipped over by
+ *    a status filter are ever touched.
+ */
+void do_history(char **argv)
+{
+	struct histhdr_t *hdr;
+	struct histrec_t *recs, *rec;
+	int64_t n, lo, hi, i, since = INT64_MIN, until = INT64_MAX;
+	int64_t count = HISTSHOW, shown;
+	int failed = 0, status = -1;
+	char **arg;
+
+	if (hist.fd < 0){
+		printf("history: no history log (start the shell with -H file)\n");
+		return;
+	}
+	for (arg = argv + 1; *arg != NULL; arg++){
+		if (!strcmp(*arg, "-a")){
+			count = INT64_MAX;
+		}else if (!strcmp(*arg, "-f")){
+			failed = 1;
+		}else if (!strcmp(*arg, "-n") && arg[1] != NULL && (count = atol(*++arg)) > 0){
+			continue;
+		}else if (!strcmp(*arg, "-e") && arg[1] != NULL && isdigit((unsigned char)*arg[1])){
+			status = atoi(*++arg);
+		}else if (!strcmp(*arg, "-s") && arg[1] != NULL && parsewhen(arg[1], &since) == 0){
+			arg++;
+		}else if (!strcmp(*arg, "-u") && arg[1] != NULL && parsewhen(arg[1], &until) == 0){
+			arg++;
+		}else{
+			printf("history: usage: history [-a | -n count] [-s when] [-u when] [-f | -e status]\n");
+			return;
+		}
+	}
+
+	//another shell may have added records since we last looked
+	if (maphist() < 0){
+		return;
+	}
+	hdr = (struct histhdr_t *)hist.map;
+	recs = (struct histrec_t *)(hist.map + sizeof(struct histrec_t));
+	n = __atomic_load_n(&hdr->nrecs, __ATOMIC_ACQUIRE);
+
+	//records are in the order jobs finished, so the range is [lo, hi)
+	lo = histfind(recs, n, since);
+	hi = (until == INT64_MAX) ? n : histfind(recs, n, until + 1);
+
+	//walking back from the newest, then printing oldest first
+	shown = 0;
+	for (i = hi; i > lo && shown < count; i--){
+		rec = &recs[i - 1];
+		if ((failed && rec->status == 0 && rec->termsig == 0) ||
+		    (status >= 0 && (rec->termsig != 0 || rec->status != status))){
+			continue;
+		}
+		shown++;
+	}
+	for (; i < hi; i++){
+		rec = &recs[i];
+		if ((failed && rec->status == 0 && rec->termsig == 0) ||
+		    (status >= 0 && (rec->termsig != 0 || rec->status != status))){
+			continue;
+		}
+		printhist(i + 1, rec);
+	}
+}
+
+/*
+ * do_limit - Execute the builtin limit command, which sets the cgroup
+ *    limits of the jobs started from now on, or with %jid first, of a
+ *    job that is already running: cpu=N% (of one CPU), mem=N[KMG] and
+ *    pids=N, each of which may also be max. With no limits it prints
+ *    the ones in force. Nothing is set unless every limit parses.
+ */
+void do_limit(char **argv)
+{
+	struct job_t *job = NULL;
+	struct cgknob_t *k;
+	char val[32], buf[MAXLINE];
+	char **arg;
+
+	if (cgdir < 0){
+		printf("limit: no cgroups (start the shell with -g cgroot)\n");
+		return;
+	}
+	arg = argv + 1;
+	if (*arg != NULL && **arg == '%'){
+		if ((job = getjobjid(&jobs, atoi(*arg + 1))) == NULL){
+			printf("%s: No such job\n", *arg);
+			return;
+		}
+		if (job->cgfd < 0){
+			printf("%s: job has no cgroup\n", *arg);
+			return;
+		}
+		arg++;
+	}
+
+	//listing the limits, as the interface files put them
+	if (*arg == NULL){
+		for (k = cgknobs; k->name != NULL; k++){
+			if (job != NULL && cgread(job->cgfd, k->file, buf, sizeof(buf)) == 0){
+				printf("%s\t%s\n", k->name, buf);
+			}else if (job == NULL){
+				printf("%s\t%s\n", k->name, k->val[0] ? k->val : "max");
 			}
 		}
+		return;
+	}
+
+	//checking every limit before setting any
+	for (; *arg != NULL; arg++){
+		if ((k = parseknob(*arg, val)) == NULL){
+			printf("limit: usage: limit [%%jid] [cpu=N%%] [mem=N[KMG]] [pids=N]\n");
+			return;
+		}
+		if (!k->enabled){
+			printf("limit: %s: the %s controller is not available\n", k->name, k->ctl);
+			return;
+		}
+	}
+	for (arg = argv + (job ? 2 : 1); *arg != NULL; arg++){
+		k = parseknob(*arg, val);
+		if (job == NULL){
+			strcpy(k->val, val);
+		}else if (cgwrite(job->cgfd, k->file, val) < 0){
+			printf("limit: %s: %s\n", k->file, strerror(errno));
+		}
+	}
+}
+
+/*
+ * do_jobsmax - Execute the builtin jobs-max command, which prints the
+ *    most jobs that may run in the background at once, or sets it (0
+ *    for no limit) and starts any queued jobs that now fit
+ */
+void do_jobsmax(char **argv)
+{
+	if (argv[1] == NULL){
+		printf("%d\n", maxbg);
+		return;
+	}
+	if (!isdigit((unsigned char)*argv[1]) || argv[2] != NULL){
+		printf("jobs-max: usage: jobs-max [count]\n");
+		return;
+	}
+	maxbg = atoi(argv[1]);
+	queuemoved = 1;		//eval starts what may now run
+}
+
+/*
+ * do_coproc - Execute the builtin coproc command, which starts a
+ *    command in the background with its stdin and stdout on pipes to
+ *    the shell, so later commands can write to it with >%NAME and read
+ *    what it writes back with <%NAME. It is a job like any other, and
+ *    its pipes are closed when it is deleted.
+ */
+void do_coproc(char **argv)
+{
+	struct pipeline_t pl;
+	struct stage_t st;
+	struct redir_t redirs[2];
+	struct job_t *job;
+	int in[2], out[2];
+	size_t n = 0;
+	char *line, **arg;
+	pid_t pid;
+
+	if (argv[1] == NULL || argv[2] == NULL){
+		printf("coproc: usage: coproc NAME command [args...]\n");
+		return;
+	}
+	if (getcoproc(&jobs, argv[1]) != NULL){
+		printf("coproc: %s: already running\n", argv[1]);
+		return;
+	}
+
+	//the shell keeps the coproc's stdin write end and stdout read end
+	if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0){
+		unix_error("pipe error");
+	}
+	redirs[0].op = redirop("<");
+	redirs[0].file = "";
+	redirs[0].fd = -1;
+	redirs[0].here = in[0];
+	redirs[1].op = redirop(">");
+	redirs[1].file = "";
+	redirs[1].fd = -1;
+	redirs[1].here = out[1];
+	st.argv = argv + 2;
+	st.redirs = redirs;
+	st.nredirs = 2;
+	pl.stages = &st;
+	pl.nstages = 1;
+	pl.bg = 1;
+
+	//the job list shows the whole command, name and all
+	for (arg = argv; *arg != NULL; arg++){
+		n += strlen(*arg) + 1;
+	}
+	line = arenaalloc(&arena, n + 1);
+	for (n = 0, arg = argv; *arg != NULL; arg++){
+		n += sprintf(line + n, "%s%s", *arg, arg[1] != NULL ? " " : "\n");
+	}
+
+	pid = launchjob(&pl, BG, line, NULL);
+	close(in[0]);
+	close(out[1]);
+	if (pid == 0){
+		close(in[1]);
+		close(out[0]);
+		return;
 	}
+	job = getjobpid(&jobs, pid);
+	if ((job->coname = strdup(argv[1])) == NULL){
+		unix_error("strdup error");
+	}
+	job->cofds[0] = out[0];
+	job->cofds[1] = in[1];
+	printf("[%d] (%d) %s", job->jid, pid, line);
+}
+
+/* 
+ * do_bgfg - Execute the builtin bg and fg commands
+ */
+void do_bgfg(char **argv) 
+{
+	int jid;
+	pid_t pid;
+	char *pidOrjid;
+
+	pidOrjid = argv[1];
+
+	//if command has nonexistent id after fg/bg
+	if (pidOrjid == NULL) {
+		printf("%s command requires PID or %%jobid argument\n", argv[0]);
+		return;
+	}
+
+	//checks if jid
+	if (pidOrjid[0] == '%') {
+
+		//second argument after '%' set to integer value of jid from argv
+		jid = atoi(&pidOrjid[1]);
+
+		//check if job is nonexistant
+		if(getjobjid(&jobs, jid) == NULL){
+			printf("%s: No such job\n", pidOrjid);
+			return;
+		} else if (getjobjid(&jobs, jid)->state == QU) {
+			//a queued job has nothing to continue, and starts now
+			//whatever the limit
+			struct job_t *job;
+			if ((pid = startqueued(getjobjid(&jobs, jid), !strcmp("fg", argv[0]) ? FG : BG)) == 0) {
+				return;
+			}
+			if (!strcmp("fg", argv[0])) {
+				waitfg(pid);
+			} else {
+				job = getjobjid(&jobs, jid);
+				printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+			}
+		} else {
+			pid = getjobjid(&jobs, jid)->pid;
+
+			//send continue signal
+			TRACE_MARK("continue", pid);
+			kill(-pid, SIGCONT);
+
+			//if fg input, set bg process state to fg
+			if (!strcmp("fg", argv[0])) {
+				setjobstate(&jobs, getjobpid(&jobs, pid), FG);
+				waitfg(pid);
+			}
+
+			//if bg input, set fg process state to bg
+			if (!strcmp("bg", argv[0])) {
+				struct job_t *job;
+				job = getjobpid(&jobs, pid);
+				printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+				setjobstate(&jobs, job, BG);
+			}
+		}
+	} 
+	//checks if pid
+	else if(isdigit(pidOrjid[0])) {
+
+		//get integer value of pid from argv
+		pid = atoi(pidOrjid);
+
+		//check if job is nonexistant
+		if(getjobpid(&jobs, pid) == NULL){
+			printf("(%d): No such process\n", pid);
+			return;
+		}
+		pid = getjobpid(&jobs, pid)->pid;	//any process of a job names the whole job
+
+		//send continue signal
+		TRACE_MARK("continue", pid);
+		kill(-pid, SIGCONT);
+
+		//if fg input, set bg process state to fg
+		if (!strcmp("fg", argv[0])) {
+			setjobstate(&jobs, getjobpid(&jobs, pid), FG);
+			waitfg(pid);
+		}
+
+		//if bg input, set fg process state to bg
+		if (!strcmp("bg", argv[0])) {
+			struct job_t *job;
+			job = getjobpid(&jobs, pid);
+			printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+			setjobstate(&jobs, job, BG);
+		}
+
+	} else {
+		//argv[0] equals FG/BG
+		printf("%s: argument must be a PID or %%jobid\n", argv[0]);
+		return;
+	}
+}
+
+/*
+ * do_hash - Execute the builtin hash command. With no arguments it
+ *    lists the remembered command locations, -r forgets them, and
+ *    names are looked up and remembered.
+ */
+void do_hash(char **argv)
+{
+	int i;
+
+	if (argv[1] == NULL) {
+		listhash();
+		return;
+	}
+	for (i = 1; argv[i] != NULL; i++) {
+		if (!strcmp(argv[i], "-r")) {
+			clearhash();
+		} else if (strchr(argv[i], '/') == NULL && hashcmd(argv[i]) == NULL) {
+			printf("hash: %s: not found\n", argv[i]);
+		}
+	}
+}
+
+/*
+ * launchjob - Start every stage of a pipeline in one new process group
+ *    and add them to the job list as a single job, or to job if it is
+ *    a queued one being started. All of the pipes are created before
+ *    the first stage starts, and every stage is started directly by
+ *    the shell. Returns the job's PGID, or 0 if no stage could be
+ *    started.
+ */
+pid_t launchjob(struct pipeline_t *pl, int state, char *cmdline, struct job_t *job)
+{
+	int *pipes = arenaalloc(&arena, 2 * pl->nstages * sizeof(int));
+	pid_t *pids = arenaalloc(&arena, pl->nstages * sizeof(pid_t));
+	struct timespec start;
+	pid_t pid, pgid = 0;
+	int i, n = 0, infd, outfd, jobin = 0, jobout = 1;
+	int cgfd = -1, pass;
+	long cgid = 0;
+
+	//dropping pass-through cat stages before anything starts
+	if (elidecats(pl, &jobin, &jobout) < 0)
+		return 0;
+
+	//the stages' output has to come after ours, and a child that
+	//exits without exec'ing must not flush a copy of our buffer
+	fflush(stdout);
+	drainnotes();
+
+	//creating all the pipes up front
+	for (i = 0; i < pl->nstages - 1; i++) {
+		if (pipe2(&pipes[2*i], O_CLOEXEC) < 0)
+			unix_error("pipe error");
+	}
+
+	//under -g, the stages join a new cgroup as they start
+	if (cgdir >= 0)
+		cgfd = makecgroup(&cgid);
+
+	//starting each stage with its stdin and stdout on the pipes,
+	//timing the job from the first fork
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < pl->nstages; i++) {
+		infd = (i == 0) ? jobin : pipes[2*(i-1)];
+		outfd = (i == pl->nstages - 1) ? jobout : pipes[2*i+1];
+		if ((pass = passstage(pl, i)) == PASS_TEE)
+			pid = teestage(&pl->stages[i], infd, outfd, pgid);
+		else if (pass == PASS_PAR)
+			pid = parstage(&pl->stages[i], infd, outfd, pgid);
+		else if (launcher == LAUNCH_SPAWN && findbuiltin(pl->stages[i].argv[0]) == NULL)
+			pid = spawnstage(&pl->stages[i], infd, outfd, pgid);
+		else if (launcher == LAUNCH_ZYGOTE && findbuiltin(pl->stages[i].argv[0]) == NULL)
+			pid = zygotestage(&pl->stages[i], infd, outfd, pgid);
+		else
+			pid = forkstage(&pl->stages[i], infd, outfd, pgid);
+		if (pid > 0) {
+			if (pgid == 0)
+				pgid = pid;
+			pids[n++] = pid;
+		}
+	}
+
+	//the stages hold their own pipe ends now
+	for (i = 0; i < 2*(pl->nstages - 1); i++) {
+		close(pipes[i]);
+	}
+	if (jobin != 0)
+		close(jobin);
+	if (jobout != 1)
+		close(jobout);
+	if (cgprocs >= 0) {
+		close(cgprocs);
+		cgprocs = -1;
+	}
+
+	if (n == 0 || (job == NULL && !addjob(&jobs, pgid, state, cmdline))) {
+		if (cgfd >= 0) {
+			close(cgfd);
+			sprintf(sbuf, "job%ld", cgid);
+			unlinkat(cgdir, sbuf, AT_REMOVEDIR);
+		}
+		return 0;
+	}
+	if (job == NULL) {
+		job = getjobpid(&jobs, pgid);
+	} else {
+		job->pid = pgid;
+		addjobpid(&jobs, job, pgid);
+		setjobstate(&jobs, job, state);
+	}
+	job->start = start;
+	job->cgfd = cgfd;
+	job->cgid = cgid;
+	for (i = 1; i < n; i++) {
+		addjobpid(&jobs, job, pids[i]);
+	}
+	job->nstages = n;
+	return pgid;
+}
+
+/*
+ * startqueued - Start a queued job in the given state, from the words
+ *    it was queued with, which are parsed again. Returns its PGID, or 0
+ *    if it couldn't be started, in which case it is dropped from the
+ *    list.
+ */
+pid_t startqueued(struct job_t *job, int state)
+{
+	struct arenamark_t mark;
+	struct pipeline_t pl;
+	pid_t pid = 0;
+	int timed;
+
+	arenamark(&arena, &mark);
+	if (parseline(job->runline, &pl, &timed, job->heres) == 0) {
+		//the here-docs are the pipeline's to close now
+		free(job->heres);
+		job->heres = NULL;
+		job->nheres = 0;
+		pid = launchjob(&pl, state, job->cmdline, job);
+	}
+	closeheres(&pl);
+	arenarelease(&arena, &mark);
+	if (pid == 0)
+		dropjob(&jobs, job);
+	return pid;
+}
+
+/*
+ * drainqueue - Start queued jobs in the background, oldest first, for
+ *    as long as there are fewer than maxbg jobs running there
+ */
+void drainqueue(void)
+{
+	static int draining = 0;
+	struct job_t *job;
+	pid_t pid;
+	int jid;
+
+	//a launch that runs the handlers must not start the next job
+	//from under this loop, which picks up whatever they freed
+	if (draining)
+		return;
+	draining = 1;
+	while (jobs.qhead != 0 && (maxbg == 0 || jobs.nbg < maxbg)) {
+		jid = jobs.qhead;
+		if ((pid = startqueued(&jobs.byjid[jid], BG)) != 0) {
+			job = getjobjid(&jobs, jid);	//byjid may have moved
+			notify("[%d] (%d) %s", jid, pid, job->cmdline);
+		}
+	}
+	draining = 0;
+}
+
+/*
+ * forkstage - Fork a child for one pipeline stage. The child joins
+ *    process group pgid (a new group of its own if pgid is 0), takes
+ *    infd and outfd as stdin and stdout, applies the stage's redirects
+ *    and execs the command, or runs it itself if it is a builtin.
+ *    Returns the child's PID.
+ */
+pid_t forkstage(struct stage_t *st, int infd, int outfd, pid_t pgid)
+{
+	struct redir_t *r;
+	int64_t t = 0;
+	char *path;
+	pid_t pid;
+	int fd;
+
+	//looking the command up on PATH before forking, so the
+	//command hash remembers it; a child that finds a hashed path
+	//gone names the command on stalepipe, read when it is reaped
+	path = findbuiltin(st->argv[0]) ? NULL : findcmd(st->argv[0]);
+	if (path != NULL && path != st->argv[0] && stalepipe[0] < 0 &&
+	    pipe2(stalepipe, O_CLOEXEC|O_NONBLOCK) < 0)
+		unix_error("pipe error");
+
+	TRACE_BEGIN(t);
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid > 0) {
+		TRACE_END("fork", t, pid);
+		//set in both processes, so it holds whichever runs first
+		setpgid(pid, pgid ? pgid : pid);
+		return pid;
+	}
+
+	//setting the process's group id and cgroup, which holds it from
+	//before the exec, and wiring up the pipes
+	setpgid(0, pgid);
+	joincgroup(0);
+	if (infd != 0)
+		dup2(infd, 0);
+	if (outfd != 1)
+		dup2(outfd, 1);
+
+	//opening each redirect file, or taking the fd readheres gave it,
+	//and putting it on the operator's fd
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+		TRACE_BEGIN(t);
+		if ((fd = (r->here >= 0) ? dup(r->here) : open(r->file, r->op->flags, REDIR_MODE)) < 0) {
+			fprintf(stderr, "%s: %s\n", r->file, strerror(errno));
+			exit(1);
+		}
+		TRACE_END("redirect", t, 0);
+		dup2(fd, r->op->fd);
+		close(fd);
+	}
+
+	//unblock signals and run the command; a builtin runs on the
+	//child's copy of the shell's state, with no exec at all
+	sigprocmask(SIG_SETMASK, &origmask, NULL);
+	if (builtin_cmd(st->argv))
+		exit(0);
+	TRACE_MARK("exec", 0);
+	execcmd(path, st->argv, stalepipe[1]);
+	if (errno == ENOENT) {
+		fprintf(stderr, "%s: Command not found\n", st->argv[0]);
+		exit(127);
+	}
+	fprintf(stderr, "%s: %s\n", st->argv[0], strerror(errno));
+	exit(126);
+}
+
+/*
+ * spawnstage - Start one pipeline stage with posix_spawn instead of
+ *    fork and execve. The pipe ends are dup'd onto the child's fds and
+ *    the redirect files opened there by file actions, and
+ *    POSIX_SPAWN_SETPGROUP stands in for setpgid. posix_spawn waits
+ *    for the exec, so a stage with a FIFO to open is forked instead.
+ *    Returns the child's PID, or 0 if it could not be started.
+ */
+pid_t spawnstage(struct stage_t *st, int infd, int outfd, pid_t pgid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	struct redir_t *r;
+	char **argv = st->argv;
+	int64_t t = 0;
+	pid_t pid = 0;
+	char *path;
+	int err;
+
+	if (mayblock(st))
+		return forkstage(st, infd, outfd, pgid);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP|POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setpgroup(&attr, pgid);
+	posix_spawnattr_setsigmask(&attr, &origmask);
+
+	//wiring up the pipes, then the redirects on top of them
+	if (infd != 0)
+		posix_spawn_file_actions_adddup2(&actions, infd, 0);
+	if (outfd != 1)
+		posix_spawn_file_actions_adddup2(&actions, outfd, 1);
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+		if (r->here >= 0)
+			posix_spawn_file_actions_adddup2(&actions, r->here, r->op->fd);
+		else
+			posix_spawn_file_actions_addopen(&actions, r->op->fd, r->file, r->op->flags, REDIR_MODE);
+	}
+
+	//the child opens the redirects, so a failure may be one of
+	//them; if not, a hashed path that has gone away is dropped and
+	//looked up again
+	err = ENOENT;
+	TRACE_BEGIN(t);
+	if ((path = findcmd(argv[0])) != NULL)
+		err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+	if (err != 0 && redirfailed(st)) {
+		err = -1;
+	} else if (err == ENOENT && path != NULL && path != argv[0]) {
+		unhashcmd(argv[0]);
+		if ((path = findcmd(argv[0])) != NULL)
+			err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+	}
+	TRACE_END("spawn", t, pid);
+	if (err == ENOENT) {
+		printf("%s: Command not found\n", argv[0]);
+	} else if (err > 0) {
+		printf("%s: %s\n", argv[0], strerror(err));
+	}
+	if (err != 0) {
+		pid = 0;
+	}
+
+	//posix_spawn has no hook to run in the child, so the stage joins
+	//its cgroup a moment after it has started
+	if (pid > 0) {
+		joincgroup(pid);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return pid;
+}
+
+/*
+ * zygotestage - Start one pipeline stage through the zygote, which
+ *    starts it from its own small address space instead of the
+ *    shell's. The pipe ends, stderr and the redirect files (opened
+ *    here) go with the request, to become the child's fds, so a stage
+ *    with a FIFO to open is forked instead. Returns the child's PID,
+ *    or 0 if it could not be started.
+ */
+pid_t zygotestage(struct stage_t *st, int infd, int outfd, pid_t pgid)
+{
+	struct redir_t *r;
+	char **argv = st->argv;
+	int fds[ZYGFDS], targets[ZYGFDS], n;
+	int64_t t = 0;
+	pid_t pid = 0;
+	char *path;
+
+	//the pipes and stderr, then the redirects on top of them
+	if (3 + st->nredirs > ZYGFDS || mayblock(st))
+		return forkstage(st, infd, outfd, pgid);
+	for (n = 0; n < 3; n++) {
+		targets[n] = n;
+		fds[n] = (n == 0) ? infd : (n == 1) ? outfd : 2;
+	}
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+		if ((r->fd = openredir(r)) < 0)
+			goto out;
+		targets[n] = r->op->fd;
+		fds[n++] = r->fd;
+	}
+
+	//a hashed path that has gone away is dropped and looked up again
+	pid = -ENOENT;
+	TRACE_BEGIN(t);
+	if ((path = findcmd(argv[0])) != NULL) {
+		pid = zygspawn(path, argv, pgid, fds, targets, n);
+		if (pid == -ENOENT && path != argv[0]) {
+			unhashcmd(argv[0]);
+			if ((path = findcmd(argv[0])) != NULL)
+				pid = zygspawn(path, argv, pgid, fds, targets, n);
+		}
+	}
+	TRACE_END("zygote", t, pid > 0 ? pid : 0);
+
+	//a request too big for one message is forked the usual way, and
+	//so is everything once the zygote has gone away
+	if (pid == -E2BIG || zygfd < 0) {
+		pid = forkstage(st, infd, outfd, pgid);
+	} else if (pid == -ENOENT) {
+		printf("%s: Command not found\n", argv[0]);
+		pid = 0;
+	} else if (pid < 0) {
+		printf("%s: %s\n", argv[0], strerror(-pid));
+		pid = 0;
+	} else {
+		joincgroup(pid);	//a moment after it has started, as with posix_spawn
+	}
+
+out:
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {
+		if (r->fd >= 0) {
+			close(r->fd);
+			r->fd = -1;
+		}
+	}
+	return pid;
+}
+
+/*
+ * passstage - Classify stage i of a pipeline as one the shell can run
+ *    without exec'ing anything: PASS_CAT for a bare cat that only
+ *    passes its input along (it may read the job's input file or write
+ *    its output file), PASS_TEE for "tee [-a] file..." fed by a pipe,
+ *    PASS_PAR for par, which only the shell provides, and PASS_NONE
+ *    otherwise.
+ */
+int passstage(struct pipeline_t *pl, int i)
+{
+	struct stage_t *st = &pl->stages[i];
+	char *name = st->argv[0];
+	int last = pl->nstages - 1;
+	int j;
+
+	//par has nothing to exec in its place, so -z doesn't apply
+	if (!strcmp(name, "par")) {
+		return PASS_PAR;
+	}
+	if (!fastpipes || last == 0) {
+		return PASS_NONE;
+	}
+
+	if ((!strcmp(name, "cat") || !strcmp(name, "/bin/cat") || !strcmp(name, "/usr/bin/cat"))
+	    && st->argv[1] == NULL) {
+		if (st->nredirs == 0 ||
+		    (st->nredirs == 1 && i == 0 && st->redirs[0].op->fd == 0) ||
+		    (st->nredirs == 1 && i == last && st->redirs[0].op->fd == 1)) {
+			return PASS_CAT;
+		}
+	}
+
+	if ((!strcmp(name, "tee") || !strcmp(name, "/bin/tee") || !strcmp(name, "/usr/bin/tee"))
+	    && i > 0 && st->nredirs == 0) {
+		j = (st->argv[1] != NULL && !strcmp(st->argv[1], "-a")) ? 2 : 1;
+		if (st->argv[j] == NULL) {
+			return PASS_NONE;
+		}
+		for (; st->argv[j] != NULL; j++) {
+			if (st->argv[j][0] == '-') {	//options we don't emulate
+				return PASS_NONE;
+			}
+		}
+		return PASS_TEE;
+	}
+	return PASS_NONE;
+}
+
+/*
+ * elidecats - Drop the PASS_CAT stages from a pipeline so their
+ *    neighbours are joined directly. A first-stage "cat < file" hands
+ *    the file to the next stage as *infd, and a last-stage "cat > file"
+ *    hands its file to the previous stage as *outfd. A pipeline of
+ *    nothing but cats is left alone. Returns 0, or -1 if a file could
+ *    not be opened.
+ */
+int elidecats(struct pipeline_t *pl, int *infd, int *outfd)
+{
+	struct stage_t *st;
+	int i, n = 0, fd;
+
+	for (i = 0; i < pl->nstages && passstage(pl, i) == PASS_CAT; i++)
+		;
+	if (i == pl->nstages) {
+		return 0;
+	}
+
+	for (i = 0; i < pl->nstages; i++) {
+		st = &pl->stages[i];
+		if (passstage(pl, i) != PASS_CAT) {
+			pl->stages[n++] = *st;
+			continue;
+		}
+		if (st->nredirs == 1) {
+			if ((fd = openredir(&st->redirs[0])) < 0) {
+				if (*infd != 0) {
+					close(*infd);
+				}
+				return -1;
+			}
+			if (i == 0) {
+				*infd = fd;
+			} else {
+				*outfd = fd;
+			}
+		}
+	}
+	pl->nstages = n;
+	return 0;
+}
+
+/*
+ * parstage - Run a PASS_PAR stage: "par [-j n] command [arg...] :::
+ *    input...", or with the inputs read from stdin, one per line, if
+ *    there is no :::. A forked helper runs "command arg... input" for
+ *    each input, n at a time (one per CPU by default). Each run's
+ *    stdout and stderr go to memfds, and are copied out whole once it
+ *    finishes, so the output of different runs never interleaves. The
+ *    runs stay in the job's process group, so the batch is one job:
+ *    ctrl-z, fg and bg act on all of it. The helper exits with the
+ *    number of runs that failed, at most 101. Returns its PID.
+ */
+pid_t parstage(struct stage_t *st, int infd, int outfd, pid_t pgid)
+{
+	struct parrun_t { pid_t pid; int out, err; } *runs;
+	char **argv = st->argv + 1, **inputs, **cmd;
+	struct redir_t *r;
+	char *line = NULL, *path;
+	size_t linesize = 0;
+	long maxruns = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, fd, ncmd, ninputs = 0, maxinputs = 0, next = 0, nrunning = 0;
+	int failed = 0, status;
+	ssize_t len;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid > 0) {
+		setpgid(pid, pgid ? pgid : pid);
+		return pid;
+	}
+
+	//set up like any other stage, but the helper never execs, so it
+	//needs the default signal actions back and the shell's fds closed
+	setpgid(0, pgid);
+	joincgroup(0);
+	if (infd != 0)
+		dup2(infd, 0);
+	if (outfd != 1)
+		dup2(outfd, 1);
+	for (r = st->redirs; r < st->redirs + st->nredirs; r++) {	//readheres' fds are above 2
+		if ((fd = (r->here >= 0) ? dup(r->here) : open(r->file, r->op->flags, REDIR_MODE)) < 0) {
+			fprintf(stderr, "%s: %s\n", r->file, strerror(errno));
+			exit(1);
+		}
+		dup2(fd, r->op->fd);
+		close(fd);
+	}
+	close_range(3, ~0U, 0);
+	Signal(SIGQUIT, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &origmask, NULL);
+
+	//splitting the words into the command and its inputs
+	if (*argv != NULL && !strcmp(*argv, "-j")) {
+		if (argv[1] == NULL || (maxruns = atoi(argv[1])) < 1)
+			*argv = NULL;
+		else
+			argv += 2;
+	}
+	for (ncmd = 0; argv[ncmd] != NULL && strcmp(argv[ncmd], ":::"); ncmd++)
+		;
+	if (ncmd == 0) {
+		fprintf(stderr, "par: usage: par [-j jobs] command [arg...] [::: input...]\n");
+		exit(1);
+	}
+	if (argv[ncmd] != NULL) {
+		inputs = argv + ncmd + 1;
+		while (inputs[ninputs] != NULL)
+			ninputs++;
+	} else {
+		inputs = NULL;
+		while ((len = getline(&line, &linesize, stdin)) > 0) {
+			if (ninputs == maxinputs) {
+				maxinputs = maxinputs ? 2 * maxinputs : 64;
+				if ((inputs = realloc(inputs, maxinputs * sizeof(char *))) == NULL)
+					unix_error("realloc error");
+			}
+			line[len - (line[len-1] == '\n')] = '\0';
+			if ((inputs[ninputs++] = strdup(line)) == NULL)
+				unix_error("strdup error");
+		}
+	}
+	if ((cmd = malloc((ncmd + 2) * sizeof(char *))) == NULL ||
+	    (runs = calloc(maxruns, sizeof(struct parrun_t))) == NULL)
+		unix_error("malloc error");
+	memcpy(cmd, argv, ncmd * sizeof(char *));
+	cmd[ncmd + 1] = NULL;
+	path = findcmd(cmd[0]);
+
+	while (next < ninputs || nrunning > 0) {
+		//keeping maxruns running
+		for (i = 0; i < maxruns && next < ninputs; i++) {
+			if (runs[i].pid != 0)
+				continue;
+			if ((runs[i].out = memfd_create("par.out", MFD_CLOEXEC)) < 0 ||
+			    (runs[i].err = memfd_create("par.err", MFD_CLOEXEC)) < 0)
+				unix_error("memfd_create error");
+			cmd[ncmd] = inputs[next++];
+			if ((runs[i].pid = fork()) < 0)
+				unix_error("fork error");
+			if (runs[i].pid == 0) {
+				if ((fd = open("/dev/null", O_RDONLY)) >= 0)
+					dup2(fd, 0);
+				dup2(runs[i].out, 1);
+				dup2(runs[i].err, 2);
+				execcmd(path, cmd, -1);
+				if (errno == ENOENT) {
+					fprintf(stderr, "%s: Command not found\n", cmd[0]);
+					exit(127);
+				}
+				fprintf(stderr, "%s: %s\n", cmd[0], strerror(errno));
+				exit(126);
+			}
+			nrunning++;
+		}
+
+		//copying out the output of each run as it finishes
+		if ((pid = wait(&status)) < 0) {
+			if (errno == EINTR)
+				continue;
+			unix_error("wait error");
+		}
+		for (i = 0; i < maxruns && runs[i].pid != pid; i++)
+			;
+		if (i == maxruns)
+			continue;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+		sendall(runs[i].out, 1);
+		sendall(runs[i].err, 2);
+		close(runs[i].out);
+		close(runs[i].err);
+		runs[i].pid = 0;
+		nrunning--;
+	}
+	exit(failed > 101 ? 101 : failed);
+}
+
+/*
+ * teestage - Run a PASS_TEE stage without exec'ing tee. A forked
+ *    helper in the job's process group copies its input pipe to the
+ *    files and to its output with tee(2) and splice(2), so the data
+ *    never passes through user space. Returns the helper's PID.
+ */
+pid_t teestage(struct stage_t *st, int infd, int outfd, pid_t pgid)
+{
+	struct redirop_t *op = redirop(">");
+	char **argv = st->argv + 1;
+	int *fds;
+	int i, nfds = 0, failed = 0;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		unix_error("fork error");
+	if (pid > 0) {
+		setpgid(pid, pgid ? pgid : pid);
+		return pid;
+	}
+
+	//the helper never execs, so it needs the default signal actions back,
+	//and must drop the shell's other pipe ends itself or never see EOF
+	setpgid(0, pgid);
+	joincgroup(0);
+	if (infd != 0)
+		dup2(infd, 0);
+	if (outfd != 1)
+		dup2(outfd, 1);
+	close_range(3, ~0U, 0);
+	Signal(SIGQUIT, SIG_DFL);
+	sigprocmask(SIG_SETMASK, &origmask, NULL);
+
+	//opening the files the way the > and >> redirects would
+	for (i = 0; argv[i] != NULL; i++)
+		;
+	if ((fds = malloc((i + 1) * sizeof(int))) == NULL)
+		unix_error("malloc error");
+	if (!strcmp(*argv, "-a")) {
+		op = redirop(">>");
+		argv++;
+	}
+	for (; *argv != NULL; argv++) {
+		if ((fds[nfds] = open(*argv, op->flags, REDIR_MODE)) < 0) {
+			fprintf(stderr, "tee: %s: %s\n", *argv, strerror(errno));
+			failed = 1;
+			continue;
+		}
+		nfds++;
+	}
+	if (nfds == 0) {
+		fds[nfds++] = open("/dev/null", O_WRONLY);
+	}
+
+	if (splicetee(0, 1, fds, nfds) < 0) {
+		failed = 1;
+	}
+	exit(failed);
+}
+
+/* 
+ * waitfg - Block until process pid is no longer the foreground process
+ *
+ * Signals are read from sigfd here, so the reap in sigchld_handler
+ * runs as soon as the job exits or stops, and a ctrl-c or ctrl-z that
+ * arrives meanwhile is passed on to the job.
+ */
+void waitfg(pid_t pid)
+{
+	int64_t t = 0;
+
+	if (getjobpid(&jobs, pid) == NULL){		//nothing to wait for
+		return;
+	}
+
+	TRACE_BEGIN(t);
+	while(pid == fgpid(&jobs)){
+		readsignals();				//sleeps until a signal arrives
+	}
+	TRACE_END("wait", t, pid);
+    return;
+}
+
+/*****************
+ * Signal handlers
+ *
+ * SIGCHLD, SIGINT, SIGTSTP and SIGUSR1 stay blocked and are read from
+ * sigfd, so these run from readsignals rather than in signal context.
+ *****************/
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, but doesn't wait for any other
+ *     currently running children to terminate. A job counts as
+ *     stopped once all of its live processes have stopped, and as
+ *     finished once its process group is empty, so processes a stage
+ *     started itself keep it alive. What it has to say
+ *     about the jobs goes to the notification ring, to be written out
+ *     at the next command boundary.
+ */
+void sigchld_handler(int sig) 
+{
+	struct job_t *job;
+	struct member_t *m;
+	struct rusage ru;
+	siginfo_t si;
+	pid_t pid, pgid;
+	int status;
+
+	//WNOWAIT only looks at the next child with something to report, so
+	//one the shell didn't start itself can be matched to its job by
+	//process group while it is still there to ask (the shell is a
+	//subreaper, so processes a job leaves behind come to it)
+	while (1){
+		si.si_pid = 0;
+		if (waitid(P_ALL, 0, &si, WEXITED|WSTOPPED|WCONTINUED|WNOHANG|WNOWAIT) < 0 || si.si_pid == 0){
+			break;
+		}
+		pid = si.si_pid;
+		if ((job = getjobpid(&jobs, pid)) == NULL && (pgid = getpgid(pid)) > 0 &&
+		    (job = getjobpid(&jobs, pgid)) != NULL && job->pid == pgid){
+			addjobpid(&jobs, job, pid);
+		}
+
+		//WNOHANG returns immediately if no child exits, WUNTRACED returns if child has stopped,
+		//WCONTINUED if it has been continued, and wait4 also hands back what the child used
+		if (wait4(pid, &status, WNOHANG|WUNTRACED|WCONTINUED, &ru) <= 0 || job == NULL){	//not part of any job
+			continue;
+		}
+		m = getmember(job, pid);
+		if (WIFSTOPPED(status) != 0){ //true if child process was stopped by delivery of signal
+			TRACE_MARK("stop", pid);
+			if (m->state == M_RUN){
+				m->state = M_STOP;
+				job->nstopped++;
+			}
+			job->stopsig = WSTOPSIG(status);
+			stopjob(job);
+			continue;
+		}
+		if (WIFCONTINUED(status)){
+			TRACE_MARK("continued", pid);
+			if (m->state == M_STOP){
+				m->state = M_RUN;
+				job->nstopped--;
+			}
+			if (job->state == ST){	//continued by someone other than fg or bg
+				setjobstate(&jobs, job, BG);
+			}
+			continue;
+		}
+		//true if child process was terminated by delivery of signal; a stage
+		//killed by SIGPIPE only lost its reader, which isn't worth a report
+		if (WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE){
+			job->termsig = WTERMSIG(status);
+		}
+		if (WIFEXITED(status) && m == &job->members[job->nstages - 1]){	//the last stage's status is the job's
+			job->status = WEXITSTATUS(status);
+		}
+		TRACE_MARK("reap", pid);
+		addrusage(&job->acct, &ru);	//charging the reaped process to its job
+		if (m->state == M_STOP){
+			job->nstopped--;
+		}
+		m->state = M_DONE;
+		job->nlive--;
+
+		//the job is done once its whole process group is gone; anything
+		//left in it will be reparented to the shell and reaped here
+		if (job->nlive > 0 || kill(-job->pid, 0) == 0 || errno == EPERM){
+			stopjob(job);	//the rest may all be stopped already
+			continue;
+		}
+		if (job->termsig){
+			notify("Job [%d] (%d) terminated by signal %d\n", job->jid, job->pid, job->termsig);
+		}
+		job->acct.real = sincesec(&job->start);
+		TRACE_END("job", job->start.tv_sec * 1000000000LL + job->start.tv_nsec, job->pid);
+		if (job->timed){
+			sprintacct(sbuf, &job->acct);
+			if (job->state != FG){	//naming background jobs, which finish at any time
+				notify("Job [%d] (%d) %s\n", job->jid, job->pid, sbuf);
+			}else{
+				notify("%s\n", sbuf);
+			}
+		}
+		addacct(&finished, &job->acct);
+		nfinished++;
+		if (hist.fd >= 0){
+			histappend(job);
+		}
+		deletejob(&jobs, job->pid);	//deletes terminated job
+	}
+	//the children that found a hashed path gone have said so by now
+	if (stalepipe[0] >= 0){
+		unhashstale();
+	}
+	//a background slot may have come free for a queued job
+	if (jobs.qhead != 0){
+		drainqueue();
+	}
+    return;
+}
+
+/* 
+ * stopjob - Mark a job stopped, and say so, once every process in it
+ *     that is still alive has stopped
+ */
+void stopjob(struct job_t *job)
+{
+    if (job->nlive > 0 && job->nstopped == job->nlive && job->state != ST) {
+	setjobstate(&jobs, job, ST);
+	notify("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid, job->stopsig);
+    }
+}
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenver the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.  
+ */
+void sigint_handler(int sig) 
+{
+	pid_t pid = fgpid(&jobs);
+	if(pid != 0){		//finds job in FG
+		kill(-pid, sig);		//send kill to gpid for fg jobs
+	}
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.  
+ */
+void sigtstp_handler(int sig) 
+{
+	pid_t pid = fgpid(&jobs);
+	if(pid != 0){
+		//sending SIGTSTP signal to foreground job
+		kill(-pid, sig);
+	}
+}
+
+/*********************
+ * End signal handlers
+ *********************/
+
+/*****************************************
+ * Helper routines for the event loop
+ *****************************************/
+
+/*
+ * initinput - Set up the shell's input: the string cmd if it isn't
+ *    NULL, else the file script mapped into memory, else stdin, which
+ *    is read INBUFSIZE bytes at a time. The first two are complete
+ *    once set up, so in.eof is true for them.
+ */
+void initinput(char *script, char *cmd)
+{
+    struct stat sb;
+    int fd;
+
+    if (cmd != NULL) {
+	in.buf = cmd;
+	in.len = strlen(cmd);
+	in.eof = 1;
+	return;
+    }
+    if (script == NULL) {
+	if ((in.buf = malloc(INBUFSIZE)) == NULL)
+	    unix_error("malloc error");
+	return;
+    }
+
+    if ((fd = open(script, O_RDONLY)) < 0 || fstat(fd, &sb) < 0) {
+	printf("%s: %s\n", script, strerror(errno));
+	exit(1);
+    }
+    if (sb.st_size > 0) {
+	in.buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (in.buf == MAP_FAILED)
+	    unix_error("mmap error");
+	madvise(in.buf, sb.st_size, MADV_SEQUENTIAL);
+	in.len = sb.st_size;
+    }
+    in.eof = 1;
+    close(fd);
+}
+
+/*
+ * initevents - Block SIGCHLD, SIGINT, SIGTSTP and SIGUSR1 for good, and
+ *    create the signalfd they are read from instead, plus an epoll set
+ *    that watches it together with stdin when that is the shell's input.
+ *    A driver may have started us with SIGUSR1 ignored, so that one
+ *    sent before now is dropped rather than fatal; it is taken back.
+ */
+void initevents(void)
+{
+    struct epoll_event ev;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, &origmask) < 0)
+	unix_error("sigprocmask error");
+    Signal(SIGUSR1, SIG_DFL);
+
+    /* Processes a job leaves behind when their parent exits come to
+     * the shell, so sigchld_handler can tell when a job is done */
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+	unix_error("prctl error");
+    if ((sigfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+	unix_error("signalfd error");
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	unix_error("epoll_create1 error");
+
+    ev.events = EPOLLIN;
+    ev.data.fd = sigfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev) < 0)
+	unix_error("epoll_ctl error");
+    if (in.eof) {
+	stdinpoll = 0; /* a script or -c string is already in memory */
+	return;
+    }
+    ev.data.fd = 0;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev) < 0) {
+	if (errno != EPERM)
+	    unix_error("epoll_ctl error");
+	stdinpoll = 0; /* a regular file is always readable */
+    }
+}
+
+/*
+ * initzygote - Start the zygote for -l zygote, with a socket to it
+ *    that holds one launch request or reply per message
+ */
+void initzygote(void)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0)
+	unix_error("socketpair error");
+    if ((pid = fork()) < 0)
+	unix_error("fork error");
+    if (pid == 0) {
+	/* Out of the shell's process group, and holding nothing of
+	 * the shell's but stdin, stdout, stderr and the socket */
+	setpgid(0, 0);
+	close(sv[0]);
+	if (sv[1] > 3)
+	    close_range(3, sv[1] - 1, 0);
+	close_range(sv[1] + 1, ~0U, 0);
+	zygote(sv[1]);
+    }
+    close(sv[1]);
+    zygfd = sv[0];
+}
+
+/*
+ * zygote - The zygote's loop. Each request is started with clone and
+ *    CLONE_PARENT, which makes the child the shell's rather than the
+ *    zygote's, so the shell's SIGCHLD handling and job control work
+ *    on it unchanged. CLONE_VM and CLONE_VFORK start it without
+ *    copying the zygote, and hold the zygote until it has exec'd, so
+ *    the reply can be its PID, or minus the errno that starting it
+ *    failed with. Exits when the shell closes its end of the socket.
+ */
+void zygote(int sock)
+{
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(ZYGFDS * sizeof(int))];
+    } ctl;
+    struct zygexec_t zx;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char *buf, *stack, **argv = NULL;
+    int fds[ZYGFDS], i, n;
+    ssize_t len;
+    pid_t pid;
+
+    if ((buf = malloc(ZYGMSG + 1)) == NULL || (stack = malloc(ZYGSTACK)) == NULL)
+	unix_error("malloc error");
+    while (1) {
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = ZYGMSG;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if ((len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+	    exit(0);
+	buf[len] = '\0';
+	n = 0;
+	if ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_type == SCM_RIGHTS) {
+	    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	    memcpy(fds, CMSG_DATA(cmsg), n * sizeof(int));
+	}
+
+	/* Unpacking the path and arguments */
+	zx.req = (struct zygreq_t *)buf;
+	if (zx.req->nfds > n)
+	    zx.req->nfds = n;
+	if ((argv = realloc(argv, (zx.req->argc + 1) * sizeof(char *))) == NULL)
+	    unix_error("realloc error");
+	zx.path = (char *)(zx.req + 1);
+	argv[0] = zx.path + strlen(zx.path) + 1;
+	for (i = 1; i < zx.req->argc; i++)
+	    argv[i] = argv[i-1] + strlen(argv[i-1]) + 1;
+	argv[zx.req->argc] = NULL;
+	zx.argv = argv;
+	zx.fds = fds;
+	zx.err = 0;
+
+	if ((pid = clone(zygexec, stack + ZYGSTACK, CLONE_PARENT|CLONE_VM|CLONE_VFORK, &zx)) < 0)
+	    pid = -errno;
+	else if (zx.err != 0)
+	    pid = -zx.err; /* it has exited, and the shell will reap it */
+	for (i = 0; i < n; i++)
+	    close(fds[i]);
+	write(sock, &pid, sizeof(pid));
+    }
+}
+
+/*
+ * zygexec - Run in a child of the zygote, on the zygote's memory:
+ *    join the process group, take the fds and exec the program,
+ *    leaving the errno in zx->err if that fails
+ */
+int zygexec(void *arg)
+{
+    struct zygexec_t *zx = arg;
+    int i;
+
+    setpgid(0, zx->req->pgid);
+    for (i = 0; i < zx->req->nfds; i++)
+	dup2(zx->fds[i], zx->req->targets[i]);
+    sigprocmask(SIG_SETMASK, &origmask, NULL);
+    TRACE_MARK("exec", 0);
+    execve(zx->path, zx->argv, environ);
+    zx->err = errno;
+    _exit(127);
+}
+
+/*
+ * zygspawn - Ask the zygote to start path with argv in process group
+ *    pgid, with each of fds as the child's fd in targets. Returns the
+ *    child's PID, or minus an errno: E2BIG if the request doesn't fit
+ *    in a message. If the zygote has gone away, zygfd is closed and
+ *    set to -1, and commands are forked for the rest of the session.
+ */
+pid_t zygspawn(char *path, char **argv, pid_t pgid, int *fds, int *targets, int nfds)
+{
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(ZYGFDS * sizeof(int))];
+    } ctl;
+    struct zygreq_t *req;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t len;
+    pid_t pid;
+    char *p;
+    int i;
+
+    len = sizeof(struct zygreq_t) + strlen(path) + 1;
+    for (i = 0; argv[i] != NULL; i++)
+	len += strlen(argv[i]) + 1;
+    if (len > ZYGMSG)
+	return -E2BIG;
+    req = arenaalloc(&arena, len);
+    req->pgid = pgid;
+    req->argc = i;
+    req->nfds = nfds;
+    memcpy(req->targets, targets, nfds * sizeof(int));
+    p = stpcpy((char *)(req + 1), path) + 1;
+    for (i = 0; argv[i] != NULL; i++)
+	p = stpcpy(p, argv[i]) + 1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = req;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+    if (sendmsg(zygfd, &msg, MSG_NOSIGNAL) < 0 || read(zygfd, &pid, sizeof(pid)) != sizeof(pid)) {
+	close(zygfd);
+	zygfd = -1;
+	launcher = LAUNCH_FORK;
+	return -EPIPE;
+    }
+    return pid;
+}
+
+/*
+ * readsignals - Read the pending signals from sigfd and run their
+ *    handlers. Blocks until at least one has arrived.
+ */
+void readsignals(void)
+{
+    struct signalfd_siginfo si[8];
+    ssize_t n;
+    int i;
+
+    if ((n = read(sigfd, si, sizeof(si))) < 0) {
+	if (errno == EINTR)
+	    return;
+	unix_error("signalfd read error");
+    }
+    for (i = 0; i < n / sizeof(si[0]); i++) {
+	switch (si[i].ssi_signo) {
+	case SIGCHLD:
+	    sigchld_handler(SIGCHLD);
+	    break;
+	case SIGINT:
+	    sigint_handler(SIGINT);
+	    break;
+	case SIGTSTP:
+	    sigtstp_handler(SIGTSTP);
+	    break;
+	case SIGUSR1:
+	    sigusr1_handler(SIGUSR1);
+	    break;
+	}
+    }
+}
+
+/*
+ * waitinput - Wait up to timeout ms (-1 for ever) for stdin to become
+ *    readable, running the handlers for any signals that arrive in
+ *    the meantime. Returns true if stdin is readable.
+ */
+int waitinput(int timeout)
+{
+    struct epoll_event ev[2];
+    int i, nev, ready = 0;
+
+    if (!stdinpoll)
+	timeout = 0;
+    if ((nev = epoll_wait(epfd, ev, 2, timeout)) < 0) {
+	if (errno != EINTR)
+	    unix_error("epoll_wait error");
+	nev = 0;
+    }
+    for (i = 0; i < nev; i++) {
+	if (ev[i].data.fd == sigfd)
+	    readsignals();
+	else
+	    ready = 1;
+    }
+    return ready || !stdinpoll;
+}
+
+/*
+ * readcmd - Return the next command line, newline-terminated, in a
+ *    buffer that grows to fit however long it is. Signals are checked
+ *    for between lines while any job exists, and stdout and the job
+ *    notifications are flushed before a line is handed out and before
+ *    waiting for more input. A last line without a newline
+ *    gets one. Returns NULL at end of input.
+ */
+char *readcmd(void)
+{
+    size_t len = 0, n;
+    char *nl;
+    ssize_t rc;
+
+    while (1) {
+	/* Take the rest of the line, or all of it that is buffered */
+	n = in.len - in.start;
+	if ((nl = memchr(in.buf + in.start, '\n', n)) != NULL)
+	    n = nl + 1 - (in.buf + in.start);
+	if (len + n + 2 > in.linesize) {
+	    in.linesize = 2 * (len + n + 2);
+	    if ((in.line = realloc(in.line, in.linesize)) == NULL)
+		unix_error("realloc error");
+	}
+	memcpy(in.line + len, in.buf + in.start, n);
+	len += n;
+	in.start += n;
+
+	if (nl != NULL || (in.eof && len > 0)) {
+	    if (in.line[len-1] != '\n')
+		in.line[len++] = '\n';
+	    in.line[len] = '\0';
+	    if (jobs.maxjid > 0)
+		waitinput(0); /* reap background jobs that are done */
+	    drainnotes();
+	    in.nread++;
+	    return in.line;
+	}
+	if (in.eof)
+	    return NULL;
+
+	/* Everything buffered is in line now, so refill from the start */
+	in.start = in.len = 0;
+	fflush(stdout);
+	drainnotes();
+	if (!waitinput(-1))
+	    continue;
+	if ((rc = read(0, in.buf, INBUFSIZE)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read error");
+	}
+	if (rc == 0)
+	    in.eof = 1;
+	in.len = rc;
+    }
+}
+
+/*
+ * notify - Add a job notification, one or more complete lines, to the
+ *    ring. The handlers that call this run from the main loop (see
+ *    readsignals), so the ring has one producer and one consumer that
+ *    never overlap, and needs no locking. If it is full, it is written
+ *    out first, so no notification is ever dropped.
+ */
+void notify(char *fmt, ...)
+{
+    char line[MAXLINE];
+    size_t n, off, first;
+    va_list ap;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n >= sizeof(line)) { /* cut short, but still a whole line */
+	n = sizeof(line) - 1;
+	line[n-1] = '\n';
+    }
+    if (notes.head - notes.tail + n > NOTESIZE)
+	drainnotes();
+
+    off = notes.head % NOTESIZE;
+    first = (n < NOTESIZE - off) ? n : NOTESIZE - off;
+    memcpy(notes.buf + off, line, first);
+    memcpy(notes.buf, line + first, n - first);
+    notes.head += n;
+}
+
+/*
+ * drainnotes - Write out the job notifications in the ring, after
+ *    whatever is in stdout's buffer. The ring is handed to a single
+ *    writev, in two pieces if it wraps around.
+ */
+void drainnotes(void)
+{
+    struct iovec iov[2];
+    size_t off, n;
+    ssize_t rc;
+
+    if (notes.tail == notes.head)
+	return;
+    fflush(stdout);
+    while (notes.tail != notes.head) {
+	off = notes.tail % NOTESIZE;
+	n = notes.head - notes.tail;
+	iov[0].iov_base = notes.buf + off;
+	iov[0].iov_len = (n < NOTESIZE - off) ? n : NOTESIZE - off;
+	iov[1].iov_base = notes.buf;
+	iov[1].iov_len = n - iov[0].iov_len;
+	if ((rc = writev(1, iov, iov[1].iov_len ? 2 : 1)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    notes.tail = notes.head; /* nobody is reading them */
+	    return;
+	}
+	notes.tail += rc;
+    }
+}
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* 
+ * clearjob - Clear the entries in a job struct. The members array is
+ *    kept for the next job in the slot, so reaping never frees memory.
+ */
+void clearjob(struct job_t *job) {
+    job->pid = 0;
+    job->jid = 0;
+    job->state = UNDEF;
+    free(job->cmdline);
+    job->cmdline = NULL;
+    free(job->runline);
+    job->runline = NULL;
+    job->nmembers = 0;
+    job->nstages = 0;
+    job->nlive = 0;
+    job->nstopped = 0;
+    job->stopsig = 0;
+    job->termsig = 0;
+    memset(&job->acct, 0, sizeof(job->acct));
+    job->timed = 0;
+    job->status = 0;
+    job->cgfd = -1;
+    job->cgid = 0;
+    job->qnext = 0;
+    while (job->nheres > 0)
+	close(job->heres[--job->nheres]);
+    free(job->heres);
+    job->heres = NULL;
+    if (job->coname != NULL) {
+	close(job->cofds[0]);
+	close(job->cofds[1]);
+	free(job->coname);
+	job->coname = NULL;
+    }
+}
+
+/* initjob - Initialize a job slot that has never been used */
+void initjob(struct job_t *job) {
+    job->cmdline = NULL;
+    job->runline = NULL;
+    job->members = NULL;
+    job->maxmembers = 0;
+    job->heres = NULL;
+    job->nheres = 0;
+    job->coname = NULL;
+    clearjob(job);
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct jobs_t *jobs) {
+    int i;
+
+    jobs->size = MINJOBS;
+    if ((jobs->byjid = malloc(jobs->size * sizeof(struct job_t))) == NULL)
+	unix_error("malloc error");
+    for (i = 0; i < jobs->size; i++)
+	initjob(&jobs->byjid[i]);
+    jobs->maxjid = 0;
+    jobs->fgjid = 0;
+    jobs->nbg = 0;
+    jobs->qhead = jobs->qtail = 0;
+    jobs->nqueued = 0;
+
+    jobs->pidmask = 2*MINJOBS - 1;
+    if ((jobs->bypid = calloc(jobs->pidmask + 1, sizeof(struct pidslot_t))) == NULL)
+	unix_error("calloc error");
+    jobs->npids = 0;
+}
+
+/* maxjid - Returns largest allocated job ID */
+int maxjid(struct jobs_t *jobs) 
+{
+    return jobs->maxjid;
+}
+
+/* pidhash - Home slot of a PID in the PID index */
+int pidhash(struct jobs_t *jobs, pid_t pid)
+{
+    return ((unsigned)pid * 2654435761u) & jobs->pidmask;
+}
+
+/* 
+ * pidlookup - Return the PID index slot holding pid, or the empty
+ *    slot where it would be inserted 
+ */
+struct pidslot_t *pidlookup(struct jobs_t *jobs, pid_t pid)
+{
+    int i = pidhash(jobs, pid);
+
+    while (jobs->bypid[i].pid != 0 && jobs->bypid[i].pid != pid)
+	i = (i + 1) & jobs->pidmask;
+    return &jobs->bypid[i];
+}
+
+/* 
+ * pidinsert - Map pid to jid in the PID index. The index is doubled
+ *    whenever it would become more than half full.
+ */
+void pidinsert(struct jobs_t *jobs, pid_t pid, int jid)
+{
+    struct pidslot_t *old, *slot;
+    int i, oldsize;
+
+    if (2 * (jobs->npids + 1) > jobs->pidmask + 1) {
+	old = jobs->bypid;
+	oldsize = jobs->pidmask + 1;
+	if ((jobs->bypid = calloc(2 * oldsize, sizeof(struct pidslot_t))) == NULL)
+	    unix_error("calloc error");
+	jobs->pidmask = 2 * oldsize - 1;
+	for (i = 0; i < oldsize; i++)
+	    if (old[i].pid != 0)
+		*pidlookup(jobs, old[i].pid) = old[i];
+	free(old);
+    }
+
+    slot = pidlookup(jobs, pid);
+    if (slot->pid == 0)
+	jobs->npids++;
+    slot->pid = pid;
+    slot->jid = jid;
+}
+
+/* 
+ * piddelete - Remove pid from the PID index if job jid still owns it
+ *    (the kernel may have reused it for a newer job). Later entries of
+ *    the probe run are shifted back so lookups never need tombstones.
+ */
+void piddelete(struct jobs_t *jobs, pid_t pid, int jid)
+{
+    struct pidslot_t *tab = jobs->bypid;
+    int i, j, home;
+
+    i = pidlookup(jobs, pid) - tab;
+    if (tab[i].pid == 0 || tab[i].jid != jid)
+	return;
+    jobs->npids--;
+
+    for (j = i; ; i = j) {
+	tab[i].pid = 0;
+	do {
+	    j = (j + 1) & jobs->pidmask;
+	    if (tab[j].pid == 0)
+		return;
+	    home = pidhash(jobs, tab[j].pid);
+	} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+	tab[i] = tab[j];
+    }
+}
+
+/* 
+ * addjob - Add a job to the job list. A queued job has no processes
+ *    yet, and is added with pid 0.
+ */
+int addjob(struct jobs_t *jobs, pid_t pid, int state, char *cmdline) 
+{
+    struct job_t *job;
+    int i, jid;
+    
+    if (pid < (state == QU ? 0 : 1))
+	return 0;
+
+    /* New jobs get the next ID after the largest one in use */
+    jid = jobs->maxjid + 1;
+    if (jid > MAXJID) {
+	printf("Tried to create too many jobs\n");
+	return 0; 
+    }
+    if (jid >= jobs->size) {
+	i = jobs->size;
+	jobs->size *= 2;
+	if ((jobs->byjid = realloc(jobs->byjid, jobs->size * sizeof(struct job_t))) == NULL)
+	    unix_error("realloc error");
+	for (; i < jobs->size; i++)
+	    initjob(&jobs->byjid[i]);
+    }
+
+    job = &jobs->byjid[jid];
+    job->pid = pid;
+    job->jid = jid;
+    if ((job->cmdline = strdup(cmdline)) == NULL)
+	unix_error("strdup error");
+    jobs->maxjid = jid;
+    if (pid != 0)
+	addjobpid(jobs, job, pid);
+    setjobstate(jobs, job, state);
+    if(verbose){
+	printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+    }
+    return 1;
+}
+
+/* 
+ * addjobpid - Add another process to a job: a pipeline stage, or one
+ *    the job's processes left behind in its process group
+ */
+void addjobpid(struct jobs_t *jobs, struct job_t *job, pid_t pid)
+{
+    if (job->nmembers == job->maxmembers) {
+	job->maxmembers = job->maxmembers ? 2 * job->maxmembers : 4;
+	if ((job->members = realloc(job->members, job->maxmembers * sizeof(struct member_t))) == NULL)
+	    unix_error("realloc error");
+    }
+    job->members[job->nmembers].pid = pid;
+    job->members[job->nmembers++].state = M_RUN;
+    job->nlive++;
+    pidinsert(jobs, pid, job->jid);
+}
+
+/* getmember - Find process pid among a job's processes */
+struct member_t *getmember(struct job_t *job, pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < job->nmembers; i++)
+	if (job->members[i].pid == pid)
+	    return &job->members[i];
+    return NULL;
+}
+
+/* 
+ * deletejob - Delete the job that process pid belongs to from the job
+ *    list, along with every one of its processes
+ */
+int deletejob(struct jobs_t *jobs, pid_t pid) 
+{
+    struct job_t *job;
+
+    if ((job = getjobpid(jobs, pid)) == NULL)
+	return 0;
+    dropjob(jobs, job);
+    return 1;
+}
+
+/* dropjob - Delete a job, which may be a queued one, from the job list */
+void dropjob(struct jobs_t *jobs, struct job_t *job)
+{
+    int i;
+
+    for (i = 0; i < job->nmembers; i++)
+	piddelete(jobs, job->members[i].pid, job->jid);
+    if (job->cgfd >= 0)
+	rmcgroup(job);
+    setjobstate(jobs, job, UNDEF);
+    clearjob(job);
+    while (jobs->maxjid > 0 && jobs->byjid[jobs->maxjid].jid == 0)
+	jobs->maxjid--;
+}
+
+/* 
+ * setjobstate - Change a job's state, keeping track of the FG job,
+ *    the number of BG jobs and the queue. Jobs are queued at the tail,
+ *    and normally leave from the head, but fg and bg can take one from
+ *    anywhere.
+ */
+void setjobstate(struct jobs_t *jobs, struct job_t *job, int state)
+{
+    int prev, cur;
+
+    if (job == NULL)
+	return;
+    if (jobs->fgjid == job->jid)
+	jobs->fgjid = 0;
+    if (job->state == BG)
+	jobs->nbg--;
+    if (job->state == QU && state != QU) {
+	for (prev = 0, cur = jobs->qhead; cur != job->jid; cur = jobs->byjid[cur].qnext)
+	    prev = cur;
+	if (prev == 0)
+	    jobs->qhead = job->qnext;
+	else
+	    jobs->byjid[prev].qnext = job->qnext;
+	if (jobs->qtail == job->jid)
+	    jobs->qtail = prev;
+	job->qnext = 0;
+	jobs->nqueued--;
+    }
+    if (state == FG)
+	jobs->fgjid = job->jid;
+    if (state == BG)
+	jobs->nbg++;
+    if (state == QU && job->state != QU) {
+	if (jobs->qtail == 0)
+	    jobs->qhead = job->jid;
+	else
+	    jobs->byjid[jobs->qtail].qnext = job->jid;
+	jobs->qtail = job->jid;
+	jobs->nqueued++;
+    }
+    job->state = state;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct jobs_t *jobs) {
+    return jobs->byjid[jobs->fgjid].pid;
+}
+
+/* getjobpid  - Find a job (by PID) on the job list */
+struct job_t *getjobpid(struct jobs_t *jobs, pid_t pid) {
+    struct pidslot_t *slot;
+
+    if (pid < 1)
+	return NULL;
+    slot = pidlookup(jobs, pid);
+    if (slot->pid == 0)
+	return NULL;
+    return &jobs->byjid[slot->jid];
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct jobs_t *jobs, int jid) 
+{
+    if (jid < 1 || jid > jobs->maxjid)
+	return NULL;
+    if (jobs->byjid[jid].jid == 0)
+	return NULL;
+    return &jobs->byjid[jid];
+}
+
+/* getcoproc - Find a coproc (by the name it was started with) on the job list */
+struct job_t *getcoproc(struct jobs_t *jobs, char *name)
+{
+    int jid;
+
+    for (jid = 1; jid <= jobs->maxjid; jid++)
+	if (jobs->byjid[jid].coname != NULL && !strcmp(jobs->byjid[jid].coname, name))
+	    return &jobs->byjid[jid];
+    return NULL;
+}
+
+/* pid2jid - Map process ID to job ID */
+int pid2jid(pid_t pid) 
+{
+    struct job_t *job;
+
+    if ((job = getjobpid(&jobs, pid)) == NULL)
+	return 0;
+    return job->jid;
+}
+
+/* 
+ * listjobs - Print the job list, with each queued job's place in the
+ *    queue. The long format adds a line with the
+ *    job's running time and what its reaped processes have used, and
+ *    one with what its cgroup says all of its processes are using.
+ */
+void listjobs(struct jobs_t *jobs, int longfmt) 
+{
+    struct job_t *job;
+    int i, pos = 0;
+    
+    for (i = 1; i <= jobs->maxjid; i++) {
+	job = &jobs->byjid[i];
+	if (job->state == QU) {
+	    /* Jobs are queued in JID order, as new ones get the highest */
+	    printf("[%d] (-) Queued #%d %s", job->jid, ++pos, job->cmdline);
+	    continue;
+	}
+	if (job->pid != 0) {
+	    printf("[%d] (%d) ", job->jid, job->pid);
+	    switch (job->state) {
+		case BG: 
+		    printf("Running ");
+		    break;
+		case FG: 
+		    printf("Foreground ");
+		    break;
+		case ST: 
+		    printf("Stopped ");
+		    break;
+	    default:
+		    printf("listjobs: Internal error: job[%d].state=%d ", 
+			   i, job->state);
+	    }
+	    printf("%s", job->cmdline);
+	    if (longfmt) {
+		job->acct.real = sincesec(&job->start);
+		printf("    ");
+		printacct(&job->acct);
+		if (job->cgfd >= 0)
+		    printcgroup(job);
+	    }
+	}
+    }
+}
+/* 
+ * dumpjobs - Print the job table for a program to read: a "%jobs n"
+ *    line, then "jid pgid state live-processes" for each job (the
+ *    pgid of a queued job is 0), then %end. The first n input lines
+ *    have been run, or are running.
+ */
+void dumpjobs(struct jobs_t *jobs)
+{
+    static char *states[] = {"UNDEF", "FG", "BG", "ST", "QU"};
+    struct job_t *job;
+    int i;
+
+    printf("%%jobs %ld\n", in.nread);
+    for (i = 1; i <= jobs->maxjid; i++) {
+	job = &jobs->byjid[i];
+	if (job->jid != 0)
+	    printf("%d %d %s %d\n", job->jid, job->pid, states[job->state], job->nlive);
+    }
+    printf("%%end\n");
 }
 
-/*********************
- * End signal handlers
- *********************/
+/******************************
+ * end job list helper routines
+ ******************************/
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-    job->pid = 0;
-    job->jid = 0;
-    job->state = UNDEF;
-    job->cmdline[0] = '\0';
+/*********************************************
+ * Resource accounting helper routines
+ *********************************************/
+
+/* tvsec - Convert a timeval to seconds */
+double tvsec(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-    int i;
+/* sincesec - Seconds on the monotonic clock since start */
+double sincesec(struct timespec *start)
+{
+    struct timespec now;
 
-    for (i = 0; i < MAXJOBS; i++)
-	clearjob(&jobs[i]);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) 
+/* addrusage - Charge one reaped process to an account */
+void addrusage(struct acct_t *a, struct rusage *ru)
 {
-    int i, max=0;
+    a->user += tvsec(&ru->ru_utime);
+    a->sys += tvsec(&ru->ru_stime);
+    if (ru->ru_maxrss > a->maxrss)
+	a->maxrss = ru->ru_maxrss;
+}
 
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].jid > max)
-	    max = jobs[i].jid;
-    return max;
+/* addacct - Add a finished job's account to a total */
+void addacct(struct acct_t *sum, struct acct_t *a)
+{
+    sum->real += a->real;
+    sum->user += a->user;
+    sum->sys += a->sys;
+    if (a->maxrss > sum->maxrss)
+	sum->maxrss = a->maxrss;
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
+/* printacct - Print an account on one line */
+void printacct(struct acct_t *a)
 {
-    int i;
-    
-    if (pid < 1)
-	return 0;
+    char buf[MAXLINE];
 
-    for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid == 0) {
-		    jobs[i].pid = pid;
-		    jobs[i].state = state;
-		    jobs[i].jid = nextjid++;
-		    if (nextjid > MAXJOBS)
-			nextjid = 1;
-		    strcpy(jobs[i].cmdline, cmdline);
-	  	    if(verbose){
-		        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-	        }
-	        return 1;
-		}
+    sprintacct(buf, a);
+    printf("%s\n", buf);
+}
+
+/* sprintacct - Put an account into buf, without a newline */
+void sprintacct(char *buf, struct acct_t *a)
+{
+    sprintf(buf, "real %.3fs user %.3fs sys %.3fs maxrss %ldK",
+	    a->real, a->user, a->sys, a->maxrss);
+}
+
+/* 
+ * shellacct - Read what the shell and its reaped children have used
+ *    so far, with real set to the monotonic clock. The resident set
+ *    is the shell's own.
+ */
+void shellacct(struct acct_t *a)
+{
+    struct rusage self, children;
+    struct timespec zero = {0, 0};
+
+    if (getrusage(RUSAGE_SELF, &self) < 0 || getrusage(RUSAGE_CHILDREN, &children) < 0)
+	unix_error("getrusage error");
+    a->real = sincesec(&zero);
+    a->user = tvsec(&self.ru_utime) + tvsec(&children.ru_utime);
+    a->sys = tvsec(&self.ru_stime) + tvsec(&children.ru_stime);
+    a->maxrss = self.ru_maxrss;
+}
+
+/* 
+ * acctsummary - Print the totals over every finished job, followed
+ *    by the jobs that have not finished yet
+ */
+void acctsummary(void)
+{
+    printf("%d finished jobs: ", nfinished);
+    printacct(&finished);
+    listjobs(&jobs, 1);
+}
+
+/*********************************************
+ * end resource accounting helper routines
+ *********************************************/
+
+
+/*****************************************
+ * History log helper routines
+ *****************************************/
+
+/* 
+ * inithist - Open the history log, creating it if it doesn't exist,
+ *    and map it. The file is a header followed by fixed-size records,
+ *    one per finished job, and is shared by every shell that logs to
+ *    it; each takes an flock while it changes the file.
+ */
+void inithist(char *file)
+{
+    struct histhdr_t *hdr;
+    struct stat sb;
+
+    if ((hist.fd = open(file, O_RDWR|O_CREAT|O_CLOEXEC, 0600)) < 0) {
+	printf("%s: %s\n", file, strerror(errno));
+	exit(1);
+    }
+    flock(hist.fd, LOCK_EX);
+    if (fstat(hist.fd, &sb) < 0)
+	unix_error("fstat error");
+    if (sb.st_size == 0 &&
+	ftruncate(hist.fd, (1 + HISTGROW) * sizeof(struct histrec_t)) < 0)
+	unix_error("ftruncate error");
+    if (maphist() < 0)
+	exit(1);
+    hdr = (struct histhdr_t *)hist.map;
+    if (sb.st_size == 0) {
+	memcpy(hdr->magic, "tshhist", 8);
+	hdr->recsize = sizeof(struct histrec_t);
+    } else if (memcmp(hdr->magic, "tshhist", 8) ||
+	       hdr->recsize != sizeof(struct histrec_t)) {
+	printf("%s: not a history log\n", file);
+	exit(1);
     }
-    printf("Tried to create too many jobs\n");
-    return 0; 
+    flock(hist.fd, LOCK_UN);
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) 
+/* 
+ * maphist - Make sure the whole history log is mapped, as it may have
+ *    grown since it was last looked at. Returns -1 after reporting an
+ *    error.
+ */
+int maphist(void)
 {
-    int i;
+    struct stat sb;
+    char *map;
 
-    if (pid < 1)
+    if (fstat(hist.fd, &sb) < 0)
+	unix_error("fstat error");
+    if (sb.st_size == hist.size)
 	return 0;
+    if (sb.st_size < sizeof(struct histrec_t)) {
+	printf("history: log is truncated\n");
+	return -1;
+    }
+    if (hist.map == NULL)
+	map = mmap(NULL, sb.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, hist.fd, 0);
+    else
+	map = mremap(hist.map, hist.size, sb.st_size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+	unix_error("mmap error");
+    hist.map = map;
+    hist.size = sb.st_size;
+    return 0;
+}
 
-    for (i = 0; i < MAXJOBS; i++) {
-	if (jobs[i].pid == pid) {
-	    clearjob(&jobs[i]);
-	    nextjid = maxjid(jobs)+1;
-	    return 1;
-	}
+/* 
+ * histappend - Add a finished job to the history log. The record is
+ *    filled in before the count in the header is bumped, so a shell
+ *    that dies halfway leaves no partial record behind. The file
+ *    grows by HISTGROW records at a time.
+ */
+void histappend(struct job_t *job)
+{
+    struct histhdr_t *hdr;
+    struct histrec_t *rec;
+    struct timespec now;
+    size_t need;
+    int64_t n;
+
+    flock(hist.fd, LOCK_EX);
+    if (maphist() < 0)
+	goto out;
+    n = ((struct histhdr_t *)hist.map)->nrecs;
+    need = (n + 2) * sizeof(struct histrec_t);
+    if (need > hist.size) {
+	if (ftruncate(hist.fd, hist.size + HISTGROW * sizeof(struct histrec_t)) < 0)
+	    unix_error("ftruncate error");
+	if (maphist() < 0)
+	    goto out;
+    }
+    hdr = (struct histhdr_t *)hist.map;
+    rec = (struct histrec_t *)(hist.map + sizeof(struct histrec_t)) + n;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->end = now.tv_sec * 1000000000LL + now.tv_nsec;
+    rec->start = rec->end - (int64_t)(job->acct.real * 1e9);
+    rec->user = job->acct.user * 1e6;
+    rec->sys = job->acct.sys * 1e6;
+    rec->maxrss = job->acct.maxrss;
+    rec->pid = job->pid;
+    rec->jid = job->jid;
+    rec->status = job->status;
+    rec->termsig = job->termsig;
+    snprintf(rec->cmdline, sizeof(rec->cmdline), "%.*s",
+	     (int)strcspn(job->cmdline, "\n"), job->cmdline);
+    __atomic_store_n(&hdr->nrecs, n + 1, __ATOMIC_RELEASE);
+out:
+    flock(hist.fd, LOCK_UN);
+}
+
+/* 
+ * histfind - Return the index of the first of n records to end at or
+ *    after t, or n if none does
+ */
+int64_t histfind(struct histrec_t *recs, int64_t n, int64_t t)
+{
+    int64_t lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (recs[mid].end < t)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/* 
+ * parsewhen - Parse a history time, either @seconds since the epoch or
+ *    a time ago such as 90s, 30m, 2h or 1d, into ns since the epoch.
+ *    Returns -1 if it is neither.
+ */
+int parsewhen(char *s, int64_t *t)
+{
+    struct timespec now;
+    char *end;
+    long v;
+
+    if (s[0] == '@') {
+	v = strtol(s + 1, &end, 10);
+	if (end == s + 1 || *end != '\0' ||
+	    v > INT64_MAX / 1000000000 || v < INT64_MIN / 1000000000)
+	    return -1;
+	*t = v * 1000000000LL;
+	return 0;
+    }
+    v = strtol(s, &end, 10);
+    if (end == s || v < 0 || v > INT64_MAX / 1000000000 / 86400)
+	return -1;		/* so that no day count overflows below */
+    switch (*end) {
+    case 'd': v *= 24;	/* fall through */
+    case 'h': v *= 60;	/* fall through */
+    case 'm': v *= 60;	/* fall through */
+    case 's': break;
+    default: return -1;
     }
+    if (end[1] != '\0')
+	return -1;
+    clock_gettime(CLOCK_REALTIME, &now);
+    *t = (now.tv_sec - v) * 1000000000LL + now.tv_nsec;
     return 0;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
-    int i;
+/* printhist - Print one history record, numbered from 1 */
+void printhist(int64_t i, struct histrec_t *rec)
+{
+    char when[32];
+    time_t t = rec->start / 1000000000LL;
+
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("%5lld  %s  [%d] (%d)  ", (long long)i, when, rec->jid, rec->pid);
+    if (rec->termsig)
+	printf("signal %-3d", rec->termsig);
+    else
+	printf("exit %-5d", rec->status);
+    printf(" real %.3fs user %.3fs sys %.3fs maxrss %lldK  %s\n",
+	   (rec->end - rec->start) / 1e9, rec->user / 1e6, rec->sys / 1e6,
+	   (long long)rec->maxrss, rec->cmdline);
+}
+
+/*****************************************
+ * end history log helper routines
+ *****************************************/
+
+
+/*****************************************
+ * Phase tracing helper routines
+ *****************************************/
+
+/*
+ * inittrace - Start tracing to a file for -T. Events go to a ring in
+ *    shared memory, so children the shell forks can add theirs up to
+ *    the exec, and the shell writes the ring out as a Chrome trace
+ *    when it exits.
+ */
+void inittrace(char *file)
+{
+    if ((tracefd = open(file, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) < 0) {
+	printf("%s: %s\n", file, strerror(errno));
+	exit(1);
+    }
+    tring = mmap(NULL, sizeof(struct tracering_t), PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (tring == MAP_FAILED)
+	unix_error("mmap error");
+    tracepid = getpid();
+    atexit(flushtrace);
+}
+
+/* tracenow - Nanoseconds on the monotonic clock */
+int64_t tracenow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * traceev - Record a phase that began at start and has just ended, or
+ *    happened just now if start is -1. Once the ring is full, each
+ *    event overwrites the oldest.
+ */
+void traceev(const char *name, int64_t start, pid_t pid)
+{
+    struct traceev_t *e;
+    int64_t now = tracenow();
+
+    e = &tring->ev[__atomic_fetch_add(&tring->next, 1, __ATOMIC_RELAXED) % TRACERING];
+    e->ts = (start < 0) ? now : start;
+    e->dur = (start < 0) ? -1 : now - start;
+    e->name = name;
+    e->tid = getpid();
+    e->pid = pid;
+}
+
+/*
+ * flushtrace - Write the ring out as Chrome trace-event JSON, with a
+ *    row for each process and times in microseconds. Only the shell
+ *    writes it; a forked child that exits without exec'ing leaves it
+ *    alone.
+ */
+void flushtrace(void)
+{
+    struct traceev_t *e;
+    uint64_t i, n = tring->next;
+    FILE *fp;
+
+    if (getpid() != tracepid || (fp = fdopen(tracefd, "w")) == NULL)
+	return;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (i = (n > TRACERING) ? n - TRACERING : 0; i < n; i++) {
+	e = &tring->ev[i % TRACERING];
+	fprintf(fp, "{\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,",
+		e->name, tracepid, e->tid, e->ts / 1e3);
+	if (e->dur < 0)
+	    fprintf(fp, "\"ph\":\"i\",\"s\":\"t\"");
+	else
+	    fprintf(fp, "\"ph\":\"X\",\"dur\":%.3f", e->dur / 1e3);
+	if (e->pid != 0)
+	    fprintf(fp, ",\"args\":{\"pid\":%d}", e->pid);
+	fprintf(fp, "}%s\n", (i + 1 < n) ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+}
+
+/*****************************************
+ * end phase tracing helper routines
+ *****************************************/
+
+
+/*****************************************
+ * cgroup helper routines
+ *****************************************/
+
+/* 
+ * initcgroup - Make a cgroup for this shell under the -g root, and
+ *    turn on the cpu, memory and pids controllers for the job cgroups
+ *    inside it. A controller the root doesn't have stays off, and
+ *    limit won't set anything that needs it. The shell itself stays
+ *    where it is.
+ */
+void initcgroup(char *root)
+{
+    struct cgknob_t *k;
+    char ctl[32];
+
+    if ((cgroot = open(root, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+	printf("%s: %s\n", root, strerror(errno));
+	exit(1);
+    }
+    sprintf(sbuf, "tsh.%d", getpid());
+    if ((mkdirat(cgroot, sbuf, 0755) < 0 && errno != EEXIST) ||
+	(cgdir = openat(cgroot, sbuf, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+	printf("%s/%s: %s\n", root, sbuf, strerror(errno));
+	exit(1);
+    }
+    atexit(exitcgroup);
+
+    //a controller has to be on in every cgroup above the one using it
+    for (k = cgknobs; k->name != NULL; k++) {
+	sprintf(ctl, "+%s", k->ctl);
+	cgwrite(cgroot, "cgroup.subtree_control", ctl);
+	k->enabled = (cgwrite(cgdir, "cgroup.subtree_control", ctl) == 0);
+    }
+}
+
+/* 
+ * exitcgroup - Remove the shell's cgroup on the way out. It stays if
+ *    a job is still running in it.
+ */
+void exitcgroup(void)
+{
+    sprintf(sbuf, "tsh.%d", getpid());
+    unlinkat(cgroot, sbuf, AT_REMOVEDIR);
+}
+
+/* 
+ * cgwrite - Write a value to one of a cgroup's interface files.
+ *    Returns -1 with errno set if the kernel won't take it.
+ */
+int cgwrite(int dirfd, char *file, char *val)
+{
+    int fd, rc;
+
+    if ((fd = openat(dirfd, file, O_WRONLY|O_CLOEXEC)) < 0)
+	return -1;
+    rc = (write(fd, val, strlen(val)) < 0) ? -1 : 0;
+    close(fd);
+    return rc;
+}
+
+/* 
+ * cgread - Read one of a cgroup's interface files into buf, without
+ *    the trailing newline. Returns -1 if it can't be read.
+ */
+int cgread(int dirfd, char *file, char *buf, size_t size)
+{
+    ssize_t n;
+    int fd;
 
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].state == FG)
-	    return jobs[i].pid;
+    if ((fd = openat(dirfd, file, O_RDONLY|O_CLOEXEC)) < 0)
+	return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+	return -1;
+    while (n > 0 && buf[n-1] == '\n')
+	n--;
+    buf[n] = '\0';
     return 0;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-    int i;
+/* 
+ * makecgroup - Make the cgroup for a job that is about to start,
+ *    give it the limits set for new jobs, and open its cgroup.procs
+ *    as cgprocs for the stages to join it through. Returns the
+ *    cgroup's directory, or -1 if it couldn't be made, in which case
+ *    the job runs without one.
+ */
+int makecgroup(long *cgid)
+{
+    struct cgknob_t *k;
+    char name[32];
+    int fd;
 
-    if (pid < 1)
-	return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].pid == pid)
-	    return &jobs[i];
-    return NULL;
+    *cgid = ++cgserial;
+    sprintf(name, "job%ld", *cgid);
+    if (mkdirat(cgdir, name, 0755) < 0 ||
+	(fd = openat(cgdir, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+	printf("cgroup %s: %s\n", name, strerror(errno));
+	return -1;
+    }
+    for (k = cgknobs; k->name != NULL; k++) {
+	if (k->val[0] != '\0' && cgwrite(fd, k->file, k->val) < 0)
+	    printf("cgroup %s: %s: %s\n", name, k->file, strerror(errno));
+    }
+    if ((cgprocs = openat(fd, "cgroup.procs", O_WRONLY|O_CLOEXEC)) < 0)
+	printf("cgroup %s: cgroup.procs: %s\n", name, strerror(errno));
+    return fd;
 }
 
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) 
+/* 
+ * joincgroup - Move process pid (0 for the caller) into the cgroup of
+ *    the job being launched, if there is one
+ */
+void joincgroup(pid_t pid)
 {
-    int i;
+    char buf[16];
+    int n;
+
+    if (cgprocs < 0)
+	return;
+    n = sprintf(buf, "%d", pid);
+    write(cgprocs, buf, n);
+}
+
+/* 
+ * rmcgroup - Remove a finished job's cgroup. It stays if a process
+ *    the job left behind is still in it.
+ */
+void rmcgroup(struct job_t *job)
+{
+    char name[32];
+
+    close(job->cgfd);
+    sprintf(name, "job%ld", job->cgid);
+    unlinkat(cgdir, name, AT_REMOVEDIR);
+    job->cgfd = -1;
+}
+
+/* 
+ * parseknob - Parse a limit given as name=value, where the value is
+ *    max or a number: a percentage of one CPU for cpu (50%), bytes for
+ *    mem with an optional K, M or G, and a process count for pids.
+ *    Puts the value in the form the interface file takes in val, and
+ *    returns the limit's knob, or NULL if it doesn't parse.
+ */
+struct cgknob_t *parseknob(char *arg, char *val)
+{
+    struct cgknob_t *k;
+    char *eq, *end;
+    long n;
 
-    if (jid < 1)
+    if ((eq = strchr(arg, '=')) == NULL)
 	return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].jid == jid)
-	    return &jobs[i];
-    return NULL;
+    for (k = cgknobs; k->name != NULL; k++) {
+	if (strlen(k->name) == eq - arg && !strncmp(k->name, arg, eq - arg))
+	    break;
+    }
+    if (k->name == NULL)
+	return NULL;
+    if (!strcmp(eq + 1, "max")) {
+	strcpy(val, "max");
+	return k;
+    }
+    if (!isdigit((unsigned char)eq[1]))
+	return NULL;
+
+    errno = 0;
+    n = strtol(eq + 1, &end, 10);
+    if (errno != 0 || n <= 0 || n > 1000000000)
+	return NULL;
+    if (!strcmp(k->ctl, "cpu") && !strcmp(end, "%"))
+	sprintf(val, "%ld 100000", n * 1000);	//quota per 100ms period
+    else if (!strcmp(k->ctl, "memory") && (*end == '\0' || (strchr("KMG", *end) && end[1] == '\0')))
+	sprintf(val, "%ld%s", n, end);
+    else if (!strcmp(k->ctl, "pids") && *end == '\0')
+	sprintf(val, "%ld", n);
+    else
+	return NULL;
+    return k;
 }
 
-/* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) 
+/* 
+ * printcgroup - Print what a job's cgroup says all of its processes,
+ *    reaped or not, have used: CPU time, and the memory and number of
+ *    processes in use now, as far as the enabled controllers tell
+ */
+void printcgroup(struct job_t *job)
 {
-    int i;
+    char buf[MAXLINE], *p;
 
-    if (pid < 1)
-	return 0;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].pid == pid) {
-            return jobs[i].jid;
-        }
-    return 0;
+    printf("    cgroup job%ld", job->cgid);
+    if (cgread(job->cgfd, "cpu.stat", buf, sizeof(buf)) == 0 &&
+	(p = strstr(buf, "usage_usec ")) != NULL)
+	printf(" cpu %.3fs", atol(p + 11) / 1e6);
+    if (cgread(job->cgfd, "memory.current", buf, sizeof(buf)) == 0)
+	printf(" mem %ldK", atol(buf) / 1024);
+    if (cgread(job->cgfd, "pids.current", buf, sizeof(buf)) == 0)
+	printf(" pids %ld", atol(buf));
+    printf("\n");
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) 
+/*****************************************
+ * end cgroup helper routines
+ *****************************************/
+
+
+/*****************************************
+ * Helper routines for the command hash
+ *****************************************/
+
+/* hashname - Bucket of a command name in the command hash */
+unsigned hashname(char *name)
+{
+    unsigned h = 5381;
+
+    while (*name)
+	h = h * 33 + (unsigned char)*name++;
+    return h % HASHSIZE;
+}
+
+/* clearhash - Forget every remembered command location */
+void clearhash(void)
 {
+    struct hashent_t *e;
     int i;
-    
-    for (i = 0; i < MAXJOBS; i++) {
-	if (jobs[i].pid != 0) {
-	    printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-	    switch (jobs[i].state) {
-		case BG: 
-		    printf("Running ");
-		    break;
-		case FG: 
-		    printf("Foreground ");
-		    break;
-		case ST: 
-		    printf("Stopped ");
-		    break;
-	    default:
-		    printf("listjobs: Internal error: job[%d].state=%d ", 
-			   i, jobs[i].state);
-	    }
-	    printf("%s", jobs[i].cmdline);
+
+    for (i = 0; i < HASHSIZE; i++) {
+	while ((e = cmdhash[i]) != NULL) {
+	    cmdhash[i] = e->next;
+	    free(e->name);
+	    free(e->path);
+	    free(e);
 	}
     }
 }
-/******************************
- * end job list helper routines
- ******************************/
+
+/* 
+ * hashcmd - Return the hash entry for a bare command name, searching
+ *    PATH and remembering the result if it is not already known. The
+ *    table is flushed whenever PATH differs from the one it was built
+ *    from. Returns NULL if the command is not on PATH.
+ */
+struct hashent_t *hashcmd(char *name)
+{
+    struct hashent_t *e;
+    struct stat st;
+    char buf[MAXLINE];
+    char *path, *dir, *end;
+    unsigned h;
+
+    if ((path = getenv("PATH")) == NULL)
+	path = "";
+    if (hashpath == NULL || strcmp(path, hashpath)) {
+	clearhash();
+	free(hashpath);
+	if ((hashpath = strdup(path)) == NULL)
+	    unix_error("strdup error");
+    }
+
+    h = hashname(name);
+    for (e = cmdhash[h]; e != NULL; e = e->next)
+	if (!strcmp(e->name, name))
+	    return e;
+
+    /* Not remembered, so stat it in each PATH directory in turn */
+    for (dir = hashpath; ; dir = end + 1) {
+	end = strchrnul(dir, ':');
+	if (end == dir)		/* empty entry means the current directory */
+	    snprintf(buf, sizeof(buf), "./%s", name);
+	else
+	    snprintf(buf, sizeof(buf), "%.*s/%s", (int)(end - dir), dir, name);
+	if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+	    if ((e = malloc(sizeof(struct hashent_t))) == NULL ||
+		(e->name = strdup(name)) == NULL ||
+		(e->path = strdup(buf)) == NULL)
+		unix_error("malloc error");
+	    e->hits = 0;
+	    e->next = cmdhash[h];
+	    cmdhash[h] = e;
+	    return e;
+	}
+	if (*end == '\0')
+	    return NULL;
+    }
+}
+
+/* unhashcmd - Forget the remembered location of a command */
+void unhashcmd(char *name)
+{
+    struct hashent_t *e, **prev;
+
+    for (prev = &cmdhash[hashname(name)]; (e = *prev) != NULL; prev = &e->next) {
+	if (!strcmp(e->name, name)) {
+	    *prev = e->next;
+	    free(e->name);
+	    free(e->path);
+	    free(e);
+	    return;
+	}
+    }
+}
+
+/*
+ * unhashstale - Forget the commands forked stages found gone from
+ *    their hashed paths, which they name on stalepipe
+ */
+void unhashstale(void)
+{
+    static char buf[65536];	/* a full pipe, so no name is cut short */
+    ssize_t n;
+    char *p;
+
+    while ((n = read(stalepipe[0], buf, sizeof(buf))) > 0)
+	for (p = buf; p < buf + n; p += strlen(p) + 1)
+	    unhashcmd(p);
+}
+
+/* 
+ * findcmd - Resolve a command name to the path to execute. Names with
+ *    a slash are used as they are; bare names come from the command
+ *    hash. Returns NULL if the command is not on PATH.
+ */
+char *findcmd(char *name)
+{
+    struct hashent_t *e;
+
+    if (strchr(name, '/') != NULL)
+	return name;
+    if ((e = hashcmd(name)) == NULL)
+	return NULL;
+    e->hits++;
+    return e->path;
+}
+
+/* 
+ * execcmd - execve a command whose path findcmd returned. If a hashed
+ *    path has disappeared, the entry is dropped and PATH searched
+ *    again, and the command's name is written to stalefd (unless it
+ *    is -1) for the shell to drop its entry too. Only returns if the
+ *    command cannot be run.
+ */
+void execcmd(char *path, char **argv, int stalefd)
+{
+    if (path == NULL) {
+	errno = ENOENT;
+	return;
+    }
+    execve(path, argv, environ);
+    if (errno == ENOENT && path != argv[0]) {
+	if (stalefd >= 0)
+	    writeall(stalefd, argv[0], strlen(argv[0]) + 1);
+	unhashcmd(argv[0]);
+	if ((path = findcmd(argv[0])) != NULL)
+	    execve(path, argv, environ);
+    }
+}
+
+/* listhash - Print the remembered commands and their hit counts */
+void listhash(void)
+{
+    struct hashent_t *e;
+    int i, empty = 1;
+
+    for (i = 0; i < HASHSIZE; i++) {
+	for (e = cmdhash[i]; e != NULL; e = e->next) {
+	    if (empty)
+		printf("hits\tcommand\n");
+	    empty = 0;
+	    printf("%4d\t%s\n", e->hits, e->path);
+	}
+    }
+    if (empty)
+	printf("hash: hash table empty\n");
+}
+/*********************************
+ * end command hash helper routines
+ *********************************/
 
 
 /***********************
@@ -763,10 +4434,19 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpzn] [-l fork|spawn|zygote] [-H histfile] [-g cgroot] [-j jobs] [-T tracefile] [-c command | script]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -l   launch commands with fork+execve (default), posix_spawn,\n");
+    printf("        or a helper process forked when the shell starts\n");
+    printf("   -z   run cat and tee pipeline stages as external commands\n");
+    printf("   -c   run the commands in the given string, then exit\n");
+    printf("   -n   parse commands without running them\n");
+    printf("   -H   append every finished job to the given history log\n");
+    printf("   -g   run each job in a cgroup v2 group of its own under cgroot\n");
+    printf("   -j   run at most this many background jobs, queueing the rest\n");
+    printf("   -T   write a Chrome trace of each command's phases at exit\n");
     exit(1);
 }
 
@@ -816,5 +4496,16 @@ void sigquit_handler(int sig)
     exit(1);
 }
 
+/*
+ * sigusr1_handler - The driver program can ask for the job table at
+ *    any time, even while a foreground job is running, by sending the
+ *    shell a SIGUSR1 signal. The table is written out at once.
+ */
+void sigusr1_handler(int sig) 
+{
+    dumpjobs(&jobs);
+    fflush(stdout);
+}
+
 
 